@@ -0,0 +1,318 @@
+/******************************************************************************
+batch.c
+Jos8 headless batch runner: runs a suite of ROMs on all cores.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "chip8.h"
+#include "chip8_jit.h"
+#include "chip8_rom.h"
+
+// one ROM of the suite and its results
+typedef struct job_t
+{
+	char *rom; // rom path
+	const chip8_rom_t *image; // cached rom, NULL if it could not be loaded
+	unsigned long long hash; // final screen hash
+	unsigned long long cycles; // executed instructions
+	unsigned long unknown; // unknown opcodes encountered
+} job_t;
+
+// work-stealing deque of job indices
+// head and tail are packed into one word so the owner and thieves can both
+// claim jobs with a single compare-and-swap. padded to a cache line to keep
+// workers from false sharing.
+typedef struct worker_t
+{
+	_Atomic unsigned long long range; // head in low 32 bits, tail in high 32 bits
+	char pad[64 - sizeof(unsigned long long)];
+} worker_t;
+
+// pack head and tail of a deque
+#define RANGE(head, tail) ((unsigned long long)(tail) << 32 | (head))
+
+// global variables and settings
+unsigned long frames = 600; // frames to run per rom, 0 = no limit
+unsigned long long instructions = 0; // instructions to run per rom, 0 = no limit
+unsigned long long seed = 0x4A6F7338; // CXNN random seed
+bool screen_wrap = false; // enable DXYN screen wrapping
+bool cowgod = true; // enable Cowgod's 8XY6/8XYE+FX55/FX65 syntax
+bool jit = false; // run compiled blocks instead of the predecoded interpreter
+unsigned char mode = CHIP8_MODE_CHIP8; // machine variant
+job_t *jobs = NULL; // rom suite
+unsigned int njobs, maxjobs = 0; // number of jobs and allocated size
+worker_t *workers = NULL; // per thread job deques
+int nworkers = 0; // number of worker threads, 0 = all cores
+
+// add a rom to the suite
+void add_rom(const char *path)
+{
+	if(njobs == maxjobs)
+	{
+		maxjobs = maxjobs ? maxjobs*2 : 256;
+		jobs = realloc(jobs, maxjobs*sizeof(job_t));
+	}
+	memset(&jobs[njobs], 0, sizeof(job_t));
+	jobs[njobs++].rom = strdup(path);
+}
+
+// sort roms by path
+int compare_jobs(const void *a, const void *b)
+{
+	return strcmp(((const job_t*)a)->rom, ((const job_t*)b)->rom);
+}
+
+// add all files of a directory to the suite, in sorted order
+void add_dir(const char *path)
+{
+	DIR *dir = opendir(path);
+	if(dir == NULL)
+	{
+		fprintf(stderr, "ERROR opening %s\n", path);
+		return;
+	}
+
+	unsigned int first = njobs;
+	struct dirent *entry;
+	while((entry = readdir(dir)) != NULL)
+	{
+		if(entry->d_name[0] == '.') continue; // skip hidden files
+		char *file = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		sprintf(file, "%s%s%s", path, path[strlen(path)-1] == '/' ? "" : "/", entry->d_name);
+		struct stat st;
+		if(!stat(file, &st) && S_ISREG(st.st_mode)) add_rom(file);
+		free(file);
+	}
+	closedir(dir);
+	qsort(&jobs[first], njobs - first, sizeof(job_t), compare_jobs);
+}
+
+// add all roms named in a list file, one path per line
+void add_list(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL)
+	{
+		fprintf(stderr, "ERROR opening %s\n", path);
+		return;
+	}
+
+	char line[4096];
+	while(fgets(line, sizeof(line), fp))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		if(line[0] && line[0] != '#') add_rom(line);
+	}
+	fclose(fp);
+}
+
+// add a rom, directory or @list argument to the suite
+void add_arg(const char *arg)
+{
+	struct stat st;
+	if(arg[0] == '@') add_list(arg + 1);
+	else if(!stat(arg, &st) && S_ISDIR(st.st_mode)) add_dir(arg);
+	else add_rom(arg);
+}
+
+// run a single rom headless at full speed, j is NULL without compiler
+void run_job(chip8_t *c, chip8_jit_t *j, job_t *job)
+{
+	// reset machine and load rom
+	c->quiet = true;
+	chip8_reset(c, job->image);
+	chip8_seed(c, seed);
+	if(j) chip8_jit_flush(j);
+
+	// run in large batches, the timers follow the cycle count by themselves
+	unsigned long long total = frames*8ULL; // 0 = no limit
+	if(instructions && (!total || instructions < total)) total = instructions;
+	while(!total || c->cycles < total)
+	{
+		unsigned int n = !total || total - c->cycles > (1 << 24) ? 1 << 24 : total - c->cycles;
+		if(j) chip8_jit_run(j, n, screen_wrap, cowgod);
+		else chip8_run(c, n, screen_wrap, cowgod);
+	}
+
+	// store results
+	job->hash = chip8_screenhash(c);
+	job->cycles = c->cycles;
+	job->unknown = c->unknown;
+}
+
+// take the next job from the front of our own deque
+bool pop_job(worker_t *w, unsigned int *job)
+{
+	unsigned long long r = atomic_load(&w->range);
+	while((unsigned int)r < (unsigned int)(r >> 32))
+	{
+		if(atomic_compare_exchange_weak(&w->range, &r, r + 1))
+		{
+			*job = (unsigned int)r;
+			return true;
+		}
+	}
+	return false;
+}
+
+// steal the back half of another worker's deque into our own empty deque
+bool steal_jobs(worker_t *w, worker_t *victim)
+{
+	unsigned long long r = atomic_load(&victim->range);
+	while((unsigned int)r < (unsigned int)(r >> 32))
+	{
+		unsigned int head = (unsigned int)r;
+		unsigned int tail = (unsigned int)(r >> 32);
+		unsigned int mid = tail - (tail - head + 1)/2;
+		if(atomic_compare_exchange_weak(&victim->range, &r, RANGE(head, mid)))
+		{
+			atomic_store(&w->range, RANGE(mid, tail));
+			return true;
+		}
+	}
+	return false;
+}
+
+// worker thread: run own jobs, then steal until all deques are empty
+void *worker_main(void *arg)
+{
+	worker_t *w = arg;
+	int id = w - workers;
+	chip8_t *c = calloc(1, sizeof(chip8_t));
+	chip8_jit_t *j = jit ? chip8_jit_create(c) : NULL;
+	unsigned int job;
+
+	while(true)
+	{
+		if(pop_job(w, &job))
+		{
+			if(jobs[job].image) run_job(c, j, &jobs[job]);
+			continue;
+		}
+
+		// look for work at the other workers
+		bool stolen = false;
+		for(int i = 1; i < nworkers && !stolen; i++) stolen = steal_jobs(w, &workers[(id + i) % nworkers]);
+		if(!stolen) break;
+	}
+
+	if(j) chip8_jit_destroy(j);
+	free(c);
+	return NULL;
+}
+
+// number of available cpu cores
+int cpu_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+#endif
+}
+
+// seconds since an arbitrary point
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// batch runner
+int main(int argc, char *argv[])
+{
+	// parse arguments
+	bool limit_frames = false;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-f") && i+1 < argc) frames = strtoul(argv[++i], NULL, 0), limit_frames = true;
+		else if(!strcmp(argv[i], "-n") && i+1 < argc) instructions = strtoull(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "-j") && i+1 < argc) nworkers = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-s") && i+1 < argc) seed = strtoull(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "-w")) screen_wrap = true;
+		else if(!strcmp(argv[i], "-g")) cowgod = false;
+		else if(!strcmp(argv[i], "-x")) jit = true;
+		else if(!strcmp(argv[i], "-m") && i+1 < argc)
+		{
+			i++;
+			if(!strcmp(argv[i], "schip")) mode = CHIP8_MODE_SCHIP;
+			else if(!strcmp(argv[i], "xochip")) mode = CHIP8_MODE_XOCHIP;
+		}
+		else add_arg(argv[i]);
+	}
+	if(instructions && !limit_frames) frames = 0; // only the instruction limit applies
+
+	if(!njobs)
+	{
+		printf("Usage: Jos8-batch [-f frames] [-n instructions] [-j threads] [-s seed] [-w] [-g] [-x] [-m chip8|schip|xochip] rom|dir|@list ...\n");
+		return 1;
+	}
+
+	// load every rom once, identical roms are shared
+	chip8_romcache_t *cache = chip8_romcache_create();
+	for(unsigned int i = 0; i < njobs; i++)
+	{
+		jobs[i].image = cache ? chip8_romcache_load(cache, jobs[i].rom, mode) : NULL;
+		if(jobs[i].image == NULL) fprintf(stderr, "ERROR loading %s\n", jobs[i].rom);
+	}
+	
+	// split the suite evenly over the workers
+	if(nworkers <= 0) nworkers = cpu_count();
+	if(nworkers > (int)njobs) nworkers = njobs;
+	workers = calloc(nworkers, sizeof(worker_t));
+	for(int i = 0; i < nworkers; i++)
+	{
+		atomic_init(&workers[i].range, RANGE((unsigned long long)njobs*i/nworkers, (unsigned long long)njobs*(i+1)/nworkers));
+	}
+
+	// run all jobs
+	double start = now();
+	pthread_t *threads = malloc(nworkers*sizeof(pthread_t));
+	for(int i = 0; i < nworkers; i++) pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+	for(int i = 0; i < nworkers; i++) pthread_join(threads[i], NULL);
+	double elapsed = now() - start;
+
+	// print results in suite order
+	unsigned long long total = 0;
+	int failed = 0;
+	printf("rom,hash,instructions,unknown_opcodes\n");
+	for(unsigned int i = 0; i < njobs; i++)
+	{
+		if(jobs[i].image == NULL)
+		{
+			printf("%s,ERROR,0,0\n", jobs[i].rom);
+			failed++;
+		}
+		else printf("%s,%016llX,%llu,%lu\n", jobs[i].rom, jobs[i].hash, jobs[i].cycles, jobs[i].unknown);
+		total += jobs[i].cycles;
+	}
+	fprintf(stderr, "%u roms (%d failed) on %d threads: %llu instructions in %.3fs (%.1f MIPS)\n",
+		njobs, failed, nworkers, total, elapsed, total/elapsed/1e6);
+
+	// release memory
+	for(unsigned int i = 0; i < njobs; i++) free(jobs[i].rom);
+	if(cache) chip8_romcache_destroy(cache);
+	free(jobs);
+	free(workers);
+	free(threads);
+	return failed ? 1 : 0;
+}
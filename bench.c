@@ -0,0 +1,305 @@
+/******************************************************************************
+bench.c
+Jos8 benchmark: instructions per second of each engine on built-in
+synthetic ROMs and on real ROMs.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+#include "chip8_jit.h"
+#include "chip8_lanes.h"
+#include "chip8_rom.h"
+
+// engines
+enum { ENGINE_CYCLE, ENGINE_RUN, ENGINE_JIT, ENGINE_LANES, ENGINES };
+const char *engine_names[ENGINES] = { "cycle", "run", "jit", "lanes" };
+
+// one benchmark program
+typedef struct bench_t
+{
+	const char *suite; // synthetic, class or rom
+	const char *name; // benchmark or rom name
+	unsigned char mode; // machine variant
+	unsigned char rom[4096 - 0x200]; // rom image
+	size_t len; // rom size
+	const chip8_rom_t *image; // cached rom
+} bench_t;
+
+// synthetic programs, each loops forever
+// alu: 8XYN/7XNN arithmetic
+const unsigned short rom_alu[] =
+{
+	0x6001, 0x6103, 0x8014, 0x8105, 0x8201, 0x8312, 0x8423, 0x8506,
+	0x860E, 0x8707, 0x7801, 0x8080, 0x1204
+};
+
+// call: nested 2NNN/00EE
+const unsigned short rom_call[] =
+{
+	0x2204, 0x1200, 0x2208, 0x00EE, 0x7001, 0x00EE
+};
+
+// draw: DXYN at random coordinates, clear every 256 loops
+const unsigned short rom_draw[] =
+{
+	0xA200, 0xC03F, 0xC11F, 0xD01F, 0xD10F, 0xD018, 0xD108, 0x7201,
+	0x3200, 0x1202, 0x00E0, 0x1202
+};
+
+// memory: FX33/FX55/FX65 on a scratch area
+const unsigned short rom_memory[] =
+{
+	0xA300, 0xF033, 0xF755, 0xF765, 0x7001, 0xF029, 0x1200
+};
+
+// timer: set the delay timer and poll it until it expires
+const unsigned short rom_timer[] =
+{
+	0x6003, 0xF015, 0xF107, 0x3100, 0x1204, 0x1200
+};
+
+// hires: XO-CHIP 16x16 and 8x8 sprites on both planes of the 128x64 screen,
+// scrolling down and left every loop and right every 256 loops
+const unsigned short rom_hires[] =
+{
+	0x00FF, 0xF301, 0xA050, 0xC07F, 0xC17F, 0xD010, 0xD018, 0x00C1,
+	0x00FC, 0x7201, 0x3200, 0x1206, 0x00FB, 0x1206
+};
+
+// opcode classes: a prolog, then a body repeated until memory is full
+typedef struct kernel_t
+{
+	const char *name; // class name
+	unsigned short prolog[4]; // setup, 0 terminated
+	unsigned short body[8]; // repeated instructions, 0 terminated
+} kernel_t;
+
+const kernel_t kernels[] =
+{
+	{ "alu", { 0x6105, 0 }, { 0x8014, 0x8125, 0x7203, 0x8236, 0x6405, 0x834E, 0x8547, 0x8603 } },
+	{ "skip", { 0x6101, 0 }, { 0x3001, 0x4000, 0x9000, 0x5010, 0xE09E, 0 } },
+	{ "flow", { 0 }, { 0x2F00, 0 } },
+	{ "memory", { 0 }, { 0xAF10, 0xF033, 0xF355, 0xF365, 0xF01E, 0xF029, 0 } },
+	{ "draw", { 0xA050, 0x6105, 0x6207, 0 }, { 0xD015, 0xD125, 0xD215, 0 } },
+	{ "timer", { 0 }, { 0xF015, 0xF107, 0xF018, 0xF207, 0 } },
+	{ "rand", { 0 }, { 0xC0FF, 0xC1FF, 0 } },
+};
+
+// global variables and settings
+unsigned long long instructions = 10000000; // instructions per benchmark
+int repeats = 3; // runs per benchmark, the fastest counts
+unsigned long long seed = 0x4A6F7338; // CXNN random seed
+bool engines[ENGINES] = { true, true, true, true }; // engines to measure
+bench_t *benches = NULL; // benchmark list
+int nbenches = 0; // number of benchmarks
+
+// add an empty benchmark
+bench_t *add_bench(const char *suite, const char *name)
+{
+	benches = realloc(benches, (nbenches + 1)*sizeof(bench_t));
+	bench_t *b = &benches[nbenches++];
+	memset(b, 0, sizeof(bench_t));
+	b->suite = suite;
+	b->name = name;
+	return b;
+}
+
+// store an instruction in a benchmark rom
+void emit(bench_t *b, unsigned short opcode)
+{
+	b->rom[b->len++] = opcode >> 8;
+	b->rom[b->len++] = opcode & 0xFF;
+}
+
+// add a synthetic benchmark
+bench_t *add_synthetic(const char *name, const unsigned short *code, int n)
+{
+	bench_t *b = add_bench("synthetic", name);
+	for(int i = 0; i < n; i++) emit(b, code[i]);
+	return b;
+}
+
+// add an opcode class benchmark
+// the body fills memory up to 0xF00 and jumps back, so nearly every
+// instruction executed belongs to the class. 2NNN calls go to a 00EE at 0xF00,
+// memory writes go to 0xF10 and up.
+void add_kernel(const kernel_t *k)
+{
+	bench_t *b = add_bench("class", k->name);
+	for(int i = 0; k->prolog[i]; i++) emit(b, k->prolog[i]);
+	unsigned short loop = 0x200 + b->len;
+	int n = 0;
+	while(n < 8 && k->body[n]) n++;
+	while(b->len + 2*n + 2 <= 0xF00 - 0x200) for(int i = 0; i < n; i++) emit(b, k->body[i]);
+	emit(b, 0x1000 | loop);
+	while(b->len < 0xF00 - 0x200) emit(b, 0x0000);
+	emit(b, 0x00EE);
+}
+
+// add a real rom benchmark
+void add_rom(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	if(fp == NULL)
+	{
+		fprintf(stderr, "ERROR opening %s\n", path);
+		return;
+	}
+	bench_t *b = add_bench("rom", path);
+	b->len = fread(b->rom, 1, sizeof(b->rom), fp);
+	if(fgetc(fp) != EOF) fprintf(stderr, "ERROR %s is too large, truncated\n", path);
+	fclose(fp);
+}
+
+// seconds since an arbitrary point
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// run one benchmark on all lanes of a lane set, each lane with its own seed,
+// returns the time taken. the hash is the one of lane 0, which has the seed
+// of the other engines.
+double run_lanes(chip8_t *c, unsigned long long *hash)
+{
+	chip8_lanes_t *l = chip8_lanes_create();
+	for(int i = 0; i < CHIP8_LANES; i++)
+	{
+		chip8_seed(c, seed + i);
+		chip8_lanes_set(l, i, c);
+	}
+
+	double start = now();
+	for(unsigned long long done = 0; done < instructions;)
+	{
+		unsigned int n = instructions - done > (1 << 24) ? 1 << 24 : instructions - done;
+		chip8_lanes_run(l, n, false, true);
+		done += n;
+	}
+	double elapsed = now() - start;
+
+	chip8_lanes_get(l, 0, c);
+	chip8_lanes_destroy(l);
+	*hash = chip8_screenhash(c);
+	return elapsed;
+}
+
+// run one benchmark on one engine, returns the time taken
+// the timers tick every 8 instructions, like the SDL frontend at 480Hz
+double run_bench(chip8_t *c, chip8_jit_t *j, int engine, const bench_t *b, unsigned long long *hash)
+{
+	c->quiet = true;
+	chip8_reset(c, b->image);
+	chip8_seed(c, seed);
+	if(j) chip8_jit_flush(j);
+	if(engine == ENGINE_LANES) return run_lanes(c, hash);
+
+	double start = now();
+	while(c->cycles < instructions)
+	{
+		unsigned int n = instructions - c->cycles > (1 << 24) ? 1 << 24 : instructions - c->cycles;
+		if(engine == ENGINE_CYCLE) for(unsigned int i = 0; i < n; i++) chip8_cycle(c, false, false, true);
+		else if(engine == ENGINE_RUN) chip8_run(c, n, false, true);
+		else chip8_jit_run(j, n, false, true);
+	}
+	double elapsed = now() - start;
+
+	*hash = chip8_screenhash(c);
+	return elapsed;
+}
+
+// benchmark
+int main(int argc, char *argv[])
+{
+	// built-in benchmarks
+	add_synthetic("alu", rom_alu, sizeof(rom_alu)/2);
+	add_synthetic("call", rom_call, sizeof(rom_call)/2);
+	add_synthetic("draw", rom_draw, sizeof(rom_draw)/2);
+	add_synthetic("memory", rom_memory, sizeof(rom_memory)/2);
+	add_synthetic("timer", rom_timer, sizeof(rom_timer)/2);
+	add_synthetic("hires", rom_hires, sizeof(rom_hires)/2)->mode = CHIP8_MODE_XOCHIP;
+	for(unsigned int k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k++) add_kernel(&kernels[k]);
+
+	// parse arguments, roms are added after the built-in benchmarks
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-n") && i+1 < argc) instructions = strtoull(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "-r") && i+1 < argc) repeats = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-s") && i+1 < argc) seed = strtoull(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "-e") && i+1 < argc)
+		{
+			// comma separated engine list
+			char *list = argv[++i];
+			for(int e = 0; e < ENGINES; e++)
+			{
+				const char *found = strstr(list, engine_names[e]);
+				engines[e] = found && (found == list || found[-1] == ',');
+			}
+		}
+		else if(argv[i][0] == '-')
+		{
+			printf("Usage: Jos8-bench [-n instructions] [-r repeats] [-s seed] [-e cycle,run,jit,lanes] [rom ...]\n");
+			return 1;
+		}
+		else add_rom(argv[i]);
+	}
+	if(repeats < 1) repeats = 1;
+
+	// load all roms
+	chip8_romcache_t *cache = chip8_romcache_create();
+	for(int b = 0; b < nbenches; b++) benches[b].image = chip8_romcache_add(cache, benches[b].rom, benches[b].len, benches[b].mode);
+	
+	chip8_t *c = calloc(1, sizeof(chip8_t));
+	chip8_jit_t *j = chip8_jit_create(c);
+	if(j == NULL) engines[ENGINE_JIT] = false;
+
+	// run every benchmark on every engine, all engines must end in the same state
+	chip8_state_t *state = malloc(2*sizeof(chip8_state_t)); // first engine's, current engine's
+	int mismatches = 0;
+	printf("suite,name,engine,instructions,seconds,ips,ns_per_instruction,hash\n");
+	for(int b = 0; b < nbenches; b++)
+	{
+		unsigned long long first = 0;
+		bool have_first = false;
+		for(int e = 0; e < ENGINES; e++)
+		{
+			// the lane engine only runs CHIP-8 and counts the instructions of all lanes
+			if(!engines[e] || (e == ENGINE_LANES && benches[b].mode != CHIP8_MODE_CHIP8)) continue;
+			double best = 0;
+			unsigned long long hash = 0;
+			for(int r = 0; r < repeats; r++)
+			{
+				double t = run_bench(c, e == ENGINE_JIT ? j : NULL, e, &benches[b], &hash);
+				if(r == 0 || t < best) best = t;
+			}
+			unsigned long long ops = e == ENGINE_LANES ? c->cycles*CHIP8_LANES : c->cycles;
+			printf("%s,%s,%s,%llu,%.6f,%.0f,%.3f,%016llX\n", benches[b].suite, benches[b].name, engine_names[e],
+				ops, best, ops/best, best*1e9/ops, hash);
+			fflush(stdout);
+
+			chip8_save(c, &state[have_first]);
+			if(!have_first) first = hash, have_first = true;
+			else if(hash != first || memcmp(&state[0], &state[1], sizeof(chip8_state_t)))
+			{
+				fprintf(stderr, "MISMATCH %s %s: %s %s differs\n", benches[b].suite, benches[b].name, engine_names[e], hash != first ? "screen" : "state");
+				mismatches++;
+			}
+		}
+	}
+
+	if(j) chip8_jit_destroy(j);
+	free(state);
+	chip8_romcache_destroy(cache);
+	free(c);
+	free(benches);
+	return mismatches ? 1 : 0;
+}
@@ -10,60 +10,353 @@ CHIP-8 cpu interpreter.
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 #include "chip8.h"
+#include "chip8_trace.h"
+#include "chip8_profile.h"
 
-// global variables
-unsigned char memory[4096]; // program memory
-unsigned short opcode; // current opcode
-unsigned short pc; // program counter
-unsigned char V[16]; // data register
-unsigned short I; // index register
-unsigned short stack[16]; // stack 
-unsigned short sp; // stack pointer
-unsigned char delay_timer; // delay timer
-unsigned char sound_timer; // sound timer
-unsigned char screen[64][32];// screen
-unsigned char key[16]; // input
-unsigned char keyflag; // flag for input update used in FX0A
+// next value of the per-machine random number generator (splitmix64)
+static unsigned int chip8_rand(chip8_t *c)
+{
+	unsigned long long z = (c->rng += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return (unsigned int)((z ^ (z >> 31)) >> 32);
+}
+
+// count and report an unknown opcode
+static void chip8_unknown(chip8_t *c, unsigned short opcode)
+{
+	c->unknown++;
+	if(!c->quiet) printf("pc=0x%X ERROR: unknown opcode: 0x%X\n", c->pc, opcode);
+}
+
+// address mask: 64KB of memory on XO-CHIP, 4KB otherwise
+static inline unsigned short chip8_mask(const chip8_t *c)
+{
+	return c->mode == CHIP8_MODE_XOCHIP ? 0xFFFF : 0xFFF;
+}
+
+// bytes a skip at pc moves forward, XO-CHIP skips a 4-byte F000 NNNN whole
+static inline unsigned short chip8_skip(const chip8_t *c, unsigned short pc)
+{
+	if(c->mode != CHIP8_MODE_XOCHIP) return 4;
+	return c->memory[(unsigned short)(pc + 2)] == 0xF0 && c->memory[(unsigned short)(pc + 3)] == 0x00 ? 6 : 4;
+}
+
+// write a byte to memory, drop the predecoded instruction it belongs to and
+// mark its block written
+static inline void chip8_write(chip8_t *c, unsigned short addr, unsigned char value)
+{
+	addr &= chip8_mask(c);
+	c->memory[addr] = value;
+	c->decoded[(addr & 0xFFF) >> 1].op = 0; // above 4KB this drops an alias, which is harmless
+	c->written[addr >> 14] |= 1ULL << (addr >> 8 & 63); // block addr/256
+}
+
+// profiling hooks, compiled in with CHIP8_PROFILE and counting when a profile is attached
+#ifdef CHIP8_PROFILE
+#define PROFILE(hook) if(c->profile) hook
+#else
+#define PROFILE(hook)
+#endif
+
+#ifdef CHIP8_PROFILE
+// count the sprite pixels and collision of the DXYN just drawn
+static void chip8_profile_draw(chip8_t *c, unsigned char n)
+{
+	chip8_profile_t *p = c->profile;
+	unsigned short mask = chip8_mask(c);
+	int bytes = (n ? n : c->mode == CHIP8_MODE_CHIP8 ? 0 : 32)*__builtin_popcount(c->planes);
+	for(int i = 0; i < bytes; i++) p->pixels += __builtin_popcount(c->memory[(c->I + i) & mask]);
+	p->draws++;
+	p->collisions += c->V[0xF] != 0;
+}
+
+// count the instruction at pc, see chip8_cycle
+static void chip8_profile_cycle(chip8_t *c);
+#endif
+
+// place a w pixel sprite row at x on a 128 pixel screen row, wrapping the
+// pixels past the right edge around or cutting them off
+static inline void chip8_place(unsigned long long bits, int w, int x, bool screen_wrap, unsigned long long row[2])
+{
+	unsigned long long s = bits << (64 - w), out;
+	if(x < 64)
+	{
+		row[0] = s >> x;
+		row[1] = x ? s << (64 - x) : 0;
+		out = 0;
+	}
+	else
+	{
+		row[0] = 0;
+		row[1] = s >> (x - 64);
+		out = x > 64 ? s << (128 - x) : 0;
+	}
+	if(screen_wrap) row[0] |= out;
+}
+
+// draw an n row sprite from memory at I on the 128x64 screen or in several
+// bitplanes, VF is set on collision
+// a sprite row is placed in the two words of a screen row with a 128-bit
+// shift, or a rotate when wrapping, then tested for collision with an AND and
+// drawn with an XOR, which SSE2 does as one 128-bit value. DXY0 draws a 16x16
+// sprite on SCHIP and XO-CHIP. with two bitplanes selected the sprite for the
+// second plane follows the one for the first.
+static void chip8_drawplanes(chip8_t *c, unsigned char xs, unsigned char ys, unsigned char n, bool screen_wrap)
+{
+	int width = chip8_width(c), height = chip8_height(c);
+	int w = 8, rows = n; // sprite size
+	if(!n && c->mode != CHIP8_MODE_CHIP8) w = 16, rows = 16;
+	unsigned short mask = chip8_mask(c);
+	unsigned short addr = c->I;
+	unsigned long long collision = 0;
+	
+	// without wrapping sprites starting off screen are not drawn
+	if(screen_wrap) xs %= width, ys %= height;
+	else if(xs >= width || ys >= height) rows = 0;
+	
+	// sprite draw routine
+	for(int p = 0; p < 2; p++)
+	{
+		if(!(c->planes >> p & 1)) continue;
+		for(int y = 0; y < rows; y++, addr += w/8)
+		{
+			unsigned long long bits = c->memory[addr & mask];
+			if(w == 16) bits = bits << 8 | c->memory[(addr + 1) & mask];
+			int sy = y + ys;
+			if(sy >= height)
+			{
+				if(!screen_wrap) continue;
+				sy -= height;
+			}
+			unsigned long long *s = c->screen[p][sy];
+			if(width == 64)
+			{
+				unsigned long long row = bits << (64 - w);
+				if(screen_wrap) row = row >> xs | row << ((64 - xs) & 63);
+				else row >>= xs;
+				collision |= s[0] & row; // collision detect
+				s[0] ^= row; // draw pixels
+			}
+			else
+			{
+				unsigned long long row[2];
+				chip8_place(bits, w, xs, screen_wrap, row);
+#ifdef __SSE2__
+				__m128i r = _mm_loadu_si128((const __m128i*)row);
+				__m128i old = _mm_loadu_si128((const __m128i*)s);
+				__m128i hit = _mm_and_si128(old, r);
+				_mm_storeu_si128((__m128i*)s, _mm_xor_si128(old, r));
+				collision |= _mm_cvtsi128_si64(_mm_or_si128(hit, _mm_unpackhi_epi64(hit, hit)));
+#else
+				collision |= (s[0] & row[0]) | (s[1] & row[1]);
+				s[0] ^= row[0];
+				s[1] ^= row[1];
+#endif
+			}
+		}
+	}
+	c->V[0xF] = collision != 0;
+}
+
+// draw an n row sprite from memory at I, VF is set on collision
+// each sprite row is placed in a 64-bit screen row with one shift, or a rotate
+// when wrapping, then tested for collision with an AND and drawn with an XOR.
+// anything but an 8 pixel wide sprite on plane 0 of the 64x32 screen goes to
+// chip8_drawplanes.
+static inline __attribute__((always_inline)) void chip8_draw(chip8_t *c, unsigned char xs, unsigned char ys, unsigned char n, bool screen_wrap)
+{
+	if(c->hires || c->planes != 1 || (!n && c->mode != CHIP8_MODE_CHIP8))
+	{
+		chip8_drawplanes(c, xs, ys, n, screen_wrap);
+		return;
+	}
+	
+	unsigned short mask = chip8_mask(c);
+	unsigned long long collision = 0;
+	
+	// without wrapping sprites starting off screen are not drawn
+	if(!screen_wrap && xs >= 64) n = 0;
+	
+	// sprite draw routine
+	for (int y = 0; y < n; y++)
+	{
+		unsigned long long row = (unsigned long long)c->memory[(c->I+y) & mask] << 56;
+		if(screen_wrap) row = row >> (xs & 63) | row << ((64 - (xs & 63)) & 63);
+		else if(y+ys < 32) row >>= xs;
+		else break;
+		collision |= c->screen[0][(y+ys) % 32][0] & row; // collision detect
+		c->screen[0][(y+ys) % 32][0] ^= row; // draw pixels
+	}
+	c->V[0xF] = collision != 0;
+}
+
+// clear the selected bitplanes
+static void chip8_clear(chip8_t *c)
+{
+	for(int p = 0; p < 2; p++) if(c->planes >> p & 1) memset(c->screen[p], 0, sizeof(c->screen[p]));
+}
+
+// scroll the selected bitplanes down by n rows, up if n is negative
+static void chip8_scrolly(chip8_t *c, int n)
+{
+	int height = chip8_height(c);
+	for(int p = 0; p < 2; p++)
+	{
+		if(!(c->planes >> p & 1)) continue;
+		unsigned long long (*s)[2] = c->screen[p];
+		if(n >= 0)
+		{
+			memmove(s[n], s[0], (height - n)*sizeof(s[0]));
+			memset(s[0], 0, n*sizeof(s[0]));
+		}
+		else
+		{
+			memmove(s[0], s[-n], (height + n)*sizeof(s[0]));
+			memset(s[height + n], 0, -n*sizeof(s[0]));
+		}
+	}
+}
+
+// scroll the selected bitplanes 4 pixels left or right
+// a 128 pixel row is shifted as one value: both words shift by 4 and the
+// pixels that cross from one word to the other are moved over with a byte
+// shift, two rows at a time with AVX2. 64 pixel rows are one word, nothing
+// crosses over and pixels shifted out are lost.
+static void chip8_scrollx(chip8_t *c, bool left)
+{
+	int height = chip8_height(c);
+	for(int p = 0; p < 2; p++)
+	{
+		if(!(c->planes >> p & 1)) continue;
+		unsigned long long (*s)[2] = c->screen[p];
+#if defined(__AVX2__)
+		__m256i keep = _mm256_set1_epi64x(c->hires ? -1 : 0);
+		for(int y = 0; y < height; y += 2)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)s[y]);
+			if(left) v = _mm256_or_si256(_mm256_slli_epi64(v, 4), _mm256_and_si256(keep, _mm256_srli_si256(_mm256_srli_epi64(v, 60), 8)));
+			else v = _mm256_or_si256(_mm256_srli_epi64(v, 4), _mm256_and_si256(keep, _mm256_slli_si256(_mm256_slli_epi64(v, 60), 8)));
+			_mm256_storeu_si256((__m256i*)s[y], v);
+		}
+#elif defined(__SSE2__)
+		__m128i keep = _mm_set1_epi64x(c->hires ? -1 : 0);
+		for(int y = 0; y < height; y++)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)s[y]);
+			if(left) v = _mm_or_si128(_mm_slli_epi64(v, 4), _mm_and_si128(keep, _mm_srli_si128(_mm_srli_epi64(v, 60), 8)));
+			else v = _mm_or_si128(_mm_srli_epi64(v, 4), _mm_and_si128(keep, _mm_slli_si128(_mm_slli_epi64(v, 60), 8)));
+			_mm_storeu_si128((__m128i*)s[y], v);
+		}
+#else
+		unsigned long long keep = c->hires ? ~0ULL : 0;
+		for(int y = 0; y < height; y++)
+		{
+			if(left)
+			{
+				s[y][0] = s[y][0] << 4 | (s[y][1] >> 60 & keep);
+				s[y][1] <<= 4;
+			}
+			else
+			{
+				s[y][1] = s[y][1] >> 4 | (s[y][0] << 60 & keep);
+				s[y][0] >>= 4;
+			}
+		}
+#endif
+	}
+}
+
+// switch between the 64x32 and 128x64 screen, which clears it
+static void chip8_resolution(chip8_t *c, bool hires)
+{
+	c->hires = hires;
+	memset(c->screen, 0, sizeof(c->screen));
+}
 
 // initialize all memory and registers
-void chip8_init(void)
+void chip8_init(chip8_t *c)
 {
 	// clear screen
-	memset(screen, 0, sizeof(screen[0][0])*64*32);
+	memset(c->screen, 0, sizeof(c->screen));
 	
 	// clear input flag
-	keyflag = 16;
+	c->keyflag = 16;
+	
+	// back to the 64x32 screen drawn on plane 0 and the default audio
+	c->hires = false;
+	c->planes = 1;
+	memset(c->pattern, 0, sizeof(c->pattern));
+	c->pitch = 64;
 	
 	// clear registers and stack
-	pc = 0x200;
-	memset(V, 0, sizeof(V));
-	I = 0;
-	memset(stack, 0, sizeof(stack));
-	sp = 0;
-	opcode = 0;	
+	c->pc = 0x200;
+	memset(c->V, 0, sizeof(c->V));
+	c->I = 0;
+	memset(c->stack, 0, sizeof(c->stack));
+	c->sp = 0;
+	c->opcode = 0;	
 	
-	// reset timers 
-	delay_timer = 0;
-	sound_timer = 0; 
+	// reset statistics
+	c->cycles = 0;
+	c->unknown = 0;
 	
-	printf("CHIP-8 initialized succesfully\n");
+	// reset timers, keeping the instruction rate
+	if(!c->rate) c->rate = 480;
+	c->delay_end = 0;
+	c->sound_end = 0;
+	c->sound_cycle = 0;
+	c->tick_cycle = 0;
+	c->tick_base = 0;
+	
+	if(!c->quiet) printf("CHIP-8 initialized succesfully\n");
 }
 
-// load rom file into memory
-bool chip8_load(char* rom)
+// memory size of a machine variant
+size_t chip8_memsize(unsigned char mode)
 {
-	// clear memory and load fontset
-	memset(memory, 0, sizeof(memory));
-	for(int i = 0; i < 80; i++)	memory[i+0x50] = chip8_fontset[i];
+	return mode == CHIP8_MODE_XOCHIP ? 65536 : 4096;
+}
+
+// build the memory contents of a machine variant after loading a rom
+bool chip8_image(unsigned char *image, unsigned char mode, const unsigned char *rom, size_t len)
+{
+	// check for memory overflow
+	size_t size = chip8_memsize(mode);
+	if(len > size - 0x200) return 1;
 	
+	// clear memory, load fontsets and copy rom into memory
+	memset(image, 0, size);
+	memcpy(&image[0x50], chip8_fontset, sizeof(chip8_fontset));
+	if(mode != CHIP8_MODE_CHIP8) memcpy(&image[0xA0], chip8_bigfont, sizeof(chip8_bigfont));
+	if(len) memcpy(&image[0x200], rom, len);
+	return 0;
+}
+
+// load rom image into memory
+bool chip8_loadbuffer(chip8_t *c, const unsigned char *rom, size_t len)
+{
+	// drop predecoded instructions, all memory changes
+	memset(c->decoded, 0, sizeof(c->decoded));
+	memset(c->written, 0xFF, sizeof(c->written));
+	return chip8_image(c->memory, c->mode, rom, len);
+}
+
+// load rom file into memory
+bool chip8_load(chip8_t *c, char* rom)
+{
 	// open file
 	FILE * fp = fopen(rom, "rb");
 	
 	// check if file exists
 	if(fp == NULL)
 	{
-		printf("ERROR opening %s\n", rom);
+		if(!c->quiet) printf("ERROR opening %s\n", rom);
 		return 1;
 	}
 	
@@ -72,111 +365,182 @@ bool chip8_load(char* rom)
 	size_t len = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 	
-	// read rom file into buffer
-	unsigned char *buffer = malloc(len);
-	fread(buffer, len, 1, fp);
-	
 	// check for memory overflow
-	if (len <= (4096-0x200)) printf("Loaded %s\n", rom);
+	if(len > chip8_memsize(c->mode) - 0x200)
+	{
+		if(!c->quiet) printf("ERROR %s is too large\n", rom);
+		fclose(fp);
+		return 1;
+	}
 	
-	// read buffer into memory
-	for(int i = 0; i < len; i++) memory[i+0x200] = buffer[i];
+	// read rom file straight into memory behind the fontsets
+	chip8_loadbuffer(c, NULL, 0);
+	if(fread(&c->memory[0x200], 1, len, fp) != len)
+	{
+		if(!c->quiet) printf("ERROR reading %s\n", rom);
+		fclose(fp);
+		return 1;
+	}
+	if(!c->quiet) printf("Loaded %s\n", rom);
 	
-	// close file and free buffer
+	// close file
 	fclose(fp);
-	free(buffer);
 	return 0;
 }
 
-// emulate a single cpu cycle
-bool chip8_cycle(bool debug, bool screen_wrap, bool cowgod)
+// select the machine variant, before loading a rom
+void chip8_setmode(chip8_t *c, unsigned char mode)
 {
-	// print all registers if debug is enabled
-	if(debug)
-	{
-		printf("\nSP=%X  Stack=[", sp);
-		for(int i = 0; i < 15; i++) printf("%03X ", stack[i]);
-		printf("%03X]\nPC=0x%X  I=0x%03X  V=[",stack[15], pc, I);
-		for(int i = 0; i < 15; i++) printf("%02X ", V[i]);
-		printf("%02X]\n", V[15]);
-	}
+	c->mode = mode;
+	
+	// opcodes decode differently
+	memset(c->decoded, 0, sizeof(c->decoded));
+}
+
+// seed the random number generator used by CXNN
+void chip8_seed(chip8_t *c, unsigned long long seed)
+{
+	c->rng = seed;
+}
+
+// execute a single instruction
+static inline __attribute__((always_inline)) bool chip8_execute(chip8_t *c, bool screen_wrap, bool cowgod)
+{
+	// count executed instructions
+	c->cycles++;
 	
 	// fetch opcode
-	opcode = memory[pc] << 8 | memory[pc + 1];
+	unsigned short mask = chip8_mask(c);
+	unsigned short opcode = c->memory[c->pc & mask] << 8 | c->memory[(c->pc + 1) & mask];
+	c->opcode = opcode;
 	
 	// decode opcode
 	switch(opcode & 0xF000)
 	{
 		case 0x0000:
+			// SCHIP and XO-CHIP screen control
+			if(c->mode != CHIP8_MODE_CHIP8)
+			{
+				// 00CN 	Disp 	scroll_down(N) 	Scrolls the screen down N rows.
+				if((opcode & 0xFFF0) == 0x00C0)
+				{
+					chip8_scrolly(c, opcode & 0x000F);
+					c->pc += 2;
+					return 1;
+				}
+				
+				// 00DN 	Disp 	scroll_up(N) 	Scrolls the screen up N rows. (XO-CHIP)
+				if((opcode & 0xFFF0) == 0x00D0 && c->mode == CHIP8_MODE_XOCHIP)
+				{
+					chip8_scrolly(c, -(opcode & 0x000F));
+					c->pc += 2;
+					return 1;
+				}
+				
+				switch(opcode)
+				{
+					// 00FB 	Disp 	scroll_right() 	Scrolls the screen right 4 pixels.
+					case 0x00FB:
+						chip8_scrollx(c, false);
+						c->pc += 2;
+						return 1;
+					
+					// 00FC 	Disp 	scroll_left() 	Scrolls the screen left 4 pixels.
+					case 0x00FC:
+						chip8_scrollx(c, true);
+						c->pc += 2;
+						return 1;
+					
+					// 00FD 	Flow 	exit() 	Stops the program, pc is not advanced.
+					case 0x00FD:
+						return 0;
+					
+					// 00FE 	Disp 	lores() 	Switches to the 64x32 screen.
+					// 00FF 	Disp 	hires() 	Switches to the 128x64 screen.
+					case 0x00FE:
+					case 0x00FF:
+						chip8_resolution(c, opcode == 0x00FF);
+						c->pc += 2;
+						return 1;
+				}
+			}
+			
 			switch(opcode & 0x000F)
 			{
 				// 00E0 	Display 	disp_clear() 	Clears the screen.	
 				case 0x0000:
-					if(debug) printf("Opcode=0x%04X: 00E0 disp_clear\n", opcode);
-					memset(screen, 0, sizeof(screen[0][0])*64*32);
-					pc += 2;
+					chip8_clear(c);
+					c->pc += 2;
 					return 1; // screen update flag
 					break;
 				
 				// 00EE 	Flow 	return; 	Returns from a subroutine.
 				case 0x000E:
-					if(debug) printf("Opcode=0x%04X: 00EE return\n", opcode);
-					sp--;
-					pc = stack[sp];
+					c->sp--;
+					c->pc = c->stack[c->sp & 0xF];
 					break;
 					
 				default:
-					printf ("pc=0x%X ERROR: unknown opcode: 0x%X\n", opcode);
+					chip8_unknown(c, opcode);
 			}
 			break;
 		
 		// 1NNN 	Flow 	goto NNN; 	Jumps to address NNN.
 		case 0x1000:
-			if(debug) printf("Opcode=0x%04X: 1NNN goto NNN\n", opcode);
-			pc = opcode & 0x0FFF;
+			c->pc = opcode & 0x0FFF;
 			break;
 			
 		// 2NNN 	Flow 	*(0xNNN)() 	Calls subroutine at NNN.	
 		case 0x2000:
-			if(debug) printf("Opcode=0x%04X: 2NNN Call subroutine NNN\n", opcode);
-			stack[sp] = pc + 2;
-			sp++;
-			pc = opcode & 0x0FFF;
+			c->stack[c->sp & 0xF] = c->pc + 2;
+			c->sp++;
+			c->pc = opcode & 0x0FFF;
 			break;
 			
 		// 3XNN 	Cond 	if(Vx==NN) 	Skips the next instruction if VX equals NN. 	
 		case 0x3000:
-			if(debug) printf("Opcode=0x%04X: 3XNN skip if(Vx==NN)\n", opcode);
-			if(V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) pc += 4;
-			else pc += 2;
+			if(c->V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) c->pc += chip8_skip(c, c->pc);
+			else c->pc += 2;
 			break;
 				
 		// 4XNN 	Cond 	if(Vx!=NN) 	Skips the next instruction if VX doesn't equal NN. 	
 		case 0x4000:
-			if(debug) printf("Opcode=0x%04X: 4XNN skip if(Vx!=NN)\n", opcode);
-			if(V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) pc += 4;
-			else pc += 2;		
+			if(c->V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) c->pc += chip8_skip(c, c->pc);
+			else c->pc += 2;		
 			break;
 			
-		// 5XY0 	Cond 	if(Vx==Vy) 	Skips the next instruction if VX equals VY. 
 		case 0x5000:
-			if(debug) printf("Opcode=0x%04X: 5XY0 skip if(Vx==Vy)\n", opcode);
-			if(V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4]) pc += 4;
-			else pc += 2;
+			// 5XY2 	MEM 	reg_dump(Vx..Vy,&I) 	Stores VX to VY in memory starting at address I, I is not changed. (XO-CHIP)
+			// 5XY3 	MEM 	reg_load(Vx..Vy,&I) 	Fills VX to VY from memory starting at address I, I is not changed. (XO-CHIP)
+			// the registers go in reverse order if X is above Y
+			if(c->mode == CHIP8_MODE_XOCHIP && ((opcode & 0x000F) == 0x0002 || (opcode & 0x000F) == 0x0003))
+			{
+				int x = (opcode & 0x0F00) >> 8, y = (opcode & 0x00F0) >> 4;
+				int step = x <= y ? 1 : -1;
+				for(int i = 0; i <= abs(x - y); i++)
+				{
+					if((opcode & 0x000F) == 0x0002) chip8_write(c, c->I+i, c->V[x + i*step]);
+					else c->V[x + i*step] = c->memory[(c->I+i) & mask];
+				}
+				c->pc += 2;
+				break;
+			}
+			
+			// 5XY0 	Cond 	if(Vx==Vy) 	Skips the next instruction if VX equals VY. 
+			if(c->V[(opcode & 0x0F00) >> 8] == c->V[(opcode & 0x00F0) >> 4]) c->pc += chip8_skip(c, c->pc);
+			else c->pc += 2;
 			break;
 			
 		// 6XNN 	Const 	Vx = NN 	Sets VX to NN.	
 		case 0x6000:
-			if(debug) printf("Opcode=0x%04X: 6XNN Vx = NN \n", opcode);
-			V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
-			pc += 2;
+			c->V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
+			c->pc += 2;
 			break;
 			
 		// 7XNN 	Const 	Vx += NN 	Adds NN to VX. (Carry flag is not changed)
 		case 0x7000:
-			if(debug) printf("Opcode=0x%04X: 7XNN Vx += NN\n", opcode);
-			V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
-			pc += 2;
+			c->V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
+			c->pc += 2;
 			break;
 			
 		case 0x8000:
@@ -184,158 +548,126 @@ bool chip8_cycle(bool debug, bool screen_wrap, bool cowgod)
 			{
 				// 8XY0 	Assign 	Vx=Vy 	Sets VX to the value of VY.
 				case 0x0000:
-					if(debug) printf("Opcode=0x%04X: 8XY0 Vx=Vy\n", opcode);
-					V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
-					pc += 2;
+					c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x00F0) >> 4];
+					c->pc += 2;
 					break;
 					
 				// 8XY1 	BitOp 	Vx=Vx|Vy 	Sets VX to VX or VY. (Bitwise OR operation)
 				case 0x0001:
-					if(debug) printf("Opcode=0x%04X: 8XY1 Vx|Vy\n", opcode);
-					V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x0F00) >> 8] | V[(opcode & 0x00F0) >> 4];
-					pc += 2;
+					c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x0F00) >> 8] | c->V[(opcode & 0x00F0) >> 4];
+					c->pc += 2;
 					break;
 					
 				// 8XY2 	BitOp 	Vx=Vx&Vy 	Sets VX to VX and VY. (Bitwise AND operation)
 				case 0x0002:
-					if(debug) printf("Opcode=0x%04X: 8XY2 Vx=Vx&Vy\n", opcode);
-					V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x0F00) >> 8] & V[(opcode & 0x00F0) >> 4];
-					pc += 2;
+					c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x0F00) >> 8] & c->V[(opcode & 0x00F0) >> 4];
+					c->pc += 2;
 					break;
 					
 				// 8XY3 	BitOp 	Vx=Vx^Vy 	Sets VX to VX xor VY.
 				case 0x0003:
-					if(debug) printf("Opcode=0x%04X: 8XY3 Vx=Vx^Vy\n", opcode);
-					V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x0F00) >> 8] ^ V[(opcode & 0x00F0) >> 4];
-					pc += 2;
+					c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x0F00) >> 8] ^ c->V[(opcode & 0x00F0) >> 4];
+					c->pc += 2;
 					break;
 
 				// 8XY4 	Math 	Vx += Vy 	Adds VY to VX. 
 				// VF is set to 1 when there's a carry, and to 0 when there isn't.
 				case 0x0004:
-					if(debug) printf("Opcode=0x%04X: 8XY4 Vx += Vy\n", opcode);
-					if((V[(opcode & 0x0F00) >> 8] + V[(opcode & 0x00F0) >> 4]) > 255) V[0xF] = 1;
-					else V[0xF] = 0;
-					V[(opcode & 0x0F00) >> 8] += V[(opcode & 0x00F0) >> 4];
-					pc += 2;
+					if((c->V[(opcode & 0x0F00) >> 8] + c->V[(opcode & 0x00F0) >> 4]) > 255) c->V[0xF] = 1;
+					else c->V[0xF] = 0;
+					c->V[(opcode & 0x0F00) >> 8] += c->V[(opcode & 0x00F0) >> 4];
+					c->pc += 2;
 					break;
 					
 				// 8XY5 	Math 	Vx -= Vy 	VY is subtracted from VX. 
 				// VF is set to 0 when there's a borrow, and 1 when there isn't.
 				case 0x0005:
-					if(debug) printf("Opcode=0x%04X: 8XY5 Vx -= Vy\n", opcode);
-					if(V[(opcode & 0x0F00) >> 8] < V[(opcode & 0x00F0) >> 4]) V[0xF] = 0;
-					else V[0xF] = 1;
-					V[(opcode & 0x0F00) >> 8] -= V[(opcode & 0x00F0) >> 4];
-					pc += 2;
+					if(c->V[(opcode & 0x0F00) >> 8] < c->V[(opcode & 0x00F0) >> 4]) c->V[0xF] = 0;
+					else c->V[0xF] = 1;
+					c->V[(opcode & 0x0F00) >> 8] -= c->V[(opcode & 0x00F0) >> 4];
+					c->pc += 2;
 					break;
 					
 				// 8XY6 	BitOp 	Vx=Vy=Vy>>1 	Shifts VY right by one and copies the result to VX. 
 				// VF is set to the value of the least significant bit of VY before the shift.
 				case 0x0006:
-					if(debug) printf("Opcode=0x%04X: 8XY6 Vx=Vy=Vy>>1\n", opcode);
 					if(cowgod)
 					{
-						V[0xF] = V[(opcode & 0x0F00) >> 8] & 1;
-						V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x0F00) >> 8] >> 1;
+						c->V[0xF] = c->V[(opcode & 0x0F00) >> 8] & 1;
+						c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x0F00) >> 8] >> 1;
 					}
 					else
 					{
-						V[0xF] = V[(opcode & 0x00F0) >> 4] & 1;
-						V[(opcode & 0x00F0) >> 4] = V[(opcode & 0x00F0) >> 4] >> 1;
-						V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
+						c->V[0xF] = c->V[(opcode & 0x00F0) >> 4] & 1;
+						c->V[(opcode & 0x00F0) >> 4] = c->V[(opcode & 0x00F0) >> 4] >> 1;
+						c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x00F0) >> 4];
 					}
-					pc += 2;
+					c->pc += 2;
 					break;
 					
 				// 8XY7 	Math 	Vx=Vy-Vx 	Sets VX to VY minus VX. 
 				// VF is set to 0 when there's a borrow, and 1 when there isn't.
 				case 0x0007:
-					if(debug) printf("Opcode=0x%04X: 8XY7 Vx=Vy-Vx\n", opcode);
-					if(V[(opcode & 0x0F00) >> 8] > V[(opcode & 0x00F0) >> 4]) V[0xF] = 0;
-					else V[0xF] = 1;
-					V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4] - V[(opcode & 0x0F00) >> 8];
-					pc += 2;
+					if(c->V[(opcode & 0x0F00) >> 8] > c->V[(opcode & 0x00F0) >> 4]) c->V[0xF] = 0;
+					else c->V[0xF] = 1;
+					c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x00F0) >> 4] - c->V[(opcode & 0x0F00) >> 8];
+					c->pc += 2;
 					break;
 					
 				// 8XYE 	BitOp 	Vx=Vy=Vy<<1 	Shifts VY left by one and copies the result to VX. 
 				// VF is set to the value of the most significant bit of VY before the shift.
 				case 0x000E:
-					if(debug) printf("Opcode=0x%04X: 8XYE Vx=Vy=Vy<<1\n", opcode);
 					if(cowgod)
 					{
-						V[0xF]  = (V[(opcode & 0x0F00) >> 8] & 128) >> 7;
-						V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x0F00) >> 8] << 1;
+						c->V[0xF]  = (c->V[(opcode & 0x0F00) >> 8] & 128) >> 7;
+						c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x0F00) >> 8] << 1;
 					}
 					else
 					{
-						V[0xF] = (V[(opcode & 0x00F0) >> 4] & 128) >> 7;
-						V[(opcode & 0x00F0) >> 4] = V[(opcode & 0x00F0) >> 4] << 1;	
-						V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
+						c->V[0xF] = (c->V[(opcode & 0x00F0) >> 4] & 128) >> 7;
+						c->V[(opcode & 0x00F0) >> 4] = c->V[(opcode & 0x00F0) >> 4] << 1;	
+						c->V[(opcode & 0x0F00) >> 8] = c->V[(opcode & 0x00F0) >> 4];
 					}
-					pc += 2;
+					c->pc += 2;
 					break;
 	
 				default:
-					printf ("pc=0x%X ERROR: unknown opcode: 0x%X\n", opcode);
+					chip8_unknown(c, opcode);
 			}
 			break;
 			
 		// 9XY0 	Cond 	if(Vx!=Vy) 	Skips the next instruction if VX doesn't equal VY. 
 		// (Usually the next instruction is a jump to skip a code block)
 		case 0x9000:
-			if(debug) printf("Opcode=0x%04X: 9XY0 skip if(Vx!=Vy)\n", opcode);
-			if(V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4]) pc += 4;
-			else pc += 2;
+			if(c->V[(opcode & 0x0F00) >> 8] != c->V[(opcode & 0x00F0) >> 4]) c->pc += chip8_skip(c, c->pc);
+			else c->pc += 2;
 			break;
 			
 		// 	ANNN 	MEM 	I = NNN 	Sets I to the address NNN.
 		case 0xA000:
-			if(debug) printf("Opcode=0x%04X: ANNN I = NNN\n", opcode);
-			I = opcode & 0x0FFF;
-			pc += 2;
+			c->I = opcode & 0x0FFF;
+			c->pc += 2;
 			break;
 			
 		// BNNN 	Flow 	PC=V0+NNN 	Jumps to the address NNN plus V0.
 		case 0xB000:
-			if(debug) printf("Opcode=0x%04X: BNNN PC=V0+NNN\n", opcode);
-			pc = (opcode & 0x0FFF) + V[0];
+			c->pc = (opcode & 0x0FFF) + c->V[0];
 			break;
 			
 		// 	CXNN 	Rand 	Vx=rand()&NN 	
 		// Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
 		case 0xC000:
-			if(debug) printf("Opcode=0x%04X: CXNN Vx=rand()&NN\n", opcode);
-			V[(opcode & 0x0F00) >> 8] = (rand() % 256) & (opcode & 0x00FF);
-			pc += 2;
+			c->V[(opcode & 0x0F00) >> 8] = (chip8_rand(c) % 256) & (opcode & 0x00FF);
+			c->pc += 2;
 			break;	
 			
 		// 	DXYN 	Disp 	draw(Vx,Vy,N) 	
 		// Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
-		case 0xD000:;
-			if(debug) printf("Opcode=0x%04X: DXYN draw(Vx,Vy,N)\n", opcode);
-			unsigned char xs = V[(opcode & 0x0F00) >> 8];
-			unsigned char ys = V[(opcode & 0x00F0) >> 4];
-			unsigned char n = opcode & 0x000F;
-			unsigned char spritebyte;		
-			V[0xF] = 0;
-			
-			// sprite draw routine
-			for (int y = 0; y < n; y++)
-			{
-				spritebyte = memory[I+y];
-				for(int x = 0; x < 8; x++)
-				{
-					// check pixel value and wrap if enabled
-					if((spritebyte & (0x80 >> x)) >> (7 - x) && (screen_wrap || ((x+xs) < 64 && (y+ys) < 32)))
-					{
-							if(screen[(x+xs) % 64][(y+ys) % 32]) V[0xF] = 1; // collision detect
-							screen[(x+xs) % 64][(y+ys) % 32] ^= 1; // draw pixel
-					}	
-				}
-			}
-			
-			pc += 2;
+		// DXY0 draws a 16x16 sprite on SCHIP and XO-CHIP.
+		case 0xD000:
+			chip8_draw(c, c->V[(opcode & 0x0F00) >> 8], c->V[(opcode & 0x00F0) >> 4], opcode & 0x000F, screen_wrap);
+			PROFILE(chip8_profile_draw(c, opcode & 0x000F));
+			c->pc += 2;
 			return 1; // screen update flag
 			break;
 			
@@ -344,131 +676,650 @@ bool chip8_cycle(bool debug, bool screen_wrap, bool cowgod)
 			{
 				// EX9E 	KeyOp 	if(key()==Vx) 	Skips the next instruction if the key stored in VX is pressed. 
 				case 0x000E:
-					if(debug) printf("Opcode=0x%04X: EX9E if(key()==Vx)\n", opcode);
-					if(key[V[(opcode & 0x0F00) >> 8]]) pc += 4;
-					else pc += 2;					
+					if(c->key[c->V[(opcode & 0x0F00) >> 8] & 0xF]) c->pc += chip8_skip(c, c->pc);
+					else c->pc += 2;					
 					break;
 				
 				// EXA1 	KeyOp 	if(key()!=Vx) 	Skips the next instruction if the key stored in VX isn't pressed. 
 				case 0x0001:
-					if(debug) printf("Opcode=0x%04X: EXA1 if(key()!=Vx)\n", opcode);
-					if(!key[V[(opcode & 0x0F00) >> 8]]) pc += 4;
-					else pc += 2;
+					if(!c->key[c->V[(opcode & 0x0F00) >> 8] & 0xF]) c->pc += chip8_skip(c, c->pc);
+					else c->pc += 2;
 					break;
 				
 				default:
-				printf ("pc=0x%X ERROR: unknown opcode: 0x%X\n", opcode);
+				chip8_unknown(c, opcode);
 			}
 			break;
 			
 		case 0xF000:
+			// XO-CHIP long index, audio and bitplane opcodes
+			if(c->mode == CHIP8_MODE_XOCHIP)
+			{
+				// F000 NNNN 	MEM 	I = NNNN 	Sets I to the 16-bit address in the next two bytes.
+				if(opcode == 0xF000)
+				{
+					c->I = c->memory[(c->pc + 2) & mask] << 8 | c->memory[(c->pc + 3) & mask];
+					c->pc += 4;
+					break;
+				}
+				
+				// F002 	Sound 	audio_pattern(&I) 	Loads the 16-byte audio pattern at address I.
+				if(opcode == 0xF002)
+				{
+					for(int i = 0; i < 16; i++) c->pattern[i] = c->memory[(c->I+i) & mask];
+					c->pc += 2;
+					break;
+				}
+				
+				// FN01 	Disp 	plane(N) 	Selects the bitplanes N (0-3) drawn to.
+				if((opcode & 0x00FF) == 0x0001)
+				{
+					c->planes = (opcode & 0x0300) >> 8;
+					c->pc += 2;
+					break;
+				}
+				
+				// FX3A 	Sound 	pitch(Vx) 	Sets the audio pattern playback pitch to VX.
+				if((opcode & 0x00FF) == 0x003A)
+				{
+					c->pitch = c->V[(opcode & 0x0F00) >> 8];
+					c->pc += 2;
+					break;
+				}
+			}
+			
+			// SCHIP big font and user flags
+			if(c->mode != CHIP8_MODE_CHIP8)
+			{
+				switch(opcode & 0x00FF)
+				{
+					// FX30 	MEM 	I=bigsprite_addr[Vx] 	Sets I to the location of the 8x10 sprite for the digit in VX.
+					case 0x0030:
+						c->I = 0xA0 + (c->V[(opcode & 0x0F00) >> 8] & 0xF) * 10;
+						c->pc += 2;
+						return 0;
+					
+					// FX75 	MEM 	flags_dump(Vx) 	Stores V0 to VX (including VX) in the user flags.
+					case 0x0075:
+						for(int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) c->flags[i] = c->V[i];
+						c->pc += 2;
+						return 0;
+					
+					// FX85 	MEM 	flags_load(Vx) 	Fills V0 to VX (including VX) from the user flags.
+					case 0x0085:
+						for(int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) c->V[i] = c->flags[i];
+						c->pc += 2;
+						return 0;
+				}
+			}
+			
 			switch(opcode & 0x00FF)
 			{
 				// FX07 	Timer 	Vx = get_delay() 	Sets VX to the value of the delay timer.
 				case 0x0007:
-					if(debug) printf("Opcode=0x%04X: FX07 Vx = get_delay()\n", opcode);
-					V[(opcode & 0x0F00) >> 8] = delay_timer;
-					pc += 2;
+					c->V[(opcode & 0x0F00) >> 8] = chip8_timer(c, c->delay_end, c->cycles - 1);
+					c->pc += 2;
 					break;
 					
 				// FX0A 	KeyOp 	Vx = get_key() 	A key press is awaited, and then stored in VX. 
 				// (Blocking Operation. All instruction halted until next key event)
 				case 0x000A:
-					if(debug) printf("Opcode=0x%04X: FX0A\n", opcode);
 					for(int i = 0; i < 16; i++) // read input if no key was pressed last time
 					{
-						if(key[i] && keyflag == 16)
+						if(c->key[i] && c->keyflag == 16)
 						{
-							keyflag = i;
+							c->keyflag = i;
 						}
 					}
-					if(!key[keyflag] && keyflag != 16) // continue if key was released
+					if(c->keyflag != 16 && !c->key[c->keyflag]) // continue if key was released
 					{
-						V[(opcode & 0x0F00) >> 8] = keyflag;
-						keyflag = 16;
-						pc += 2;
+						c->V[(opcode & 0x0F00) >> 8] = c->keyflag;
+						c->keyflag = 16;
+						c->pc += 2;
 					}
 					break;	
 								
 				// FX15 	Timer 	delay_timer(Vx) 	Sets the delay timer to VX.
 				case 0x0015:
-					if(debug) printf("Opcode=0x%04X: FX15 delay_timer(Vx)\n", opcode);
-					delay_timer = V[(opcode & 0x0F00) >> 8];
-					pc += 2;
+					c->delay_end = chip8_ticks(c, c->cycles - 1) + c->V[(opcode & 0x0F00) >> 8];
+					c->pc += 2;
 					break;		
 							
 				// FX18 	Sound 	sound_timer(Vx) 	Sets the sound timer to VX.
 				case 0x0018:
-					if(debug) printf("Opcode=0x%04X: FX18 sound_timer(Vx)\n", opcode);
-					sound_timer = V[(opcode & 0x0F00) >> 8];
-					pc += 2;
+					if(!chip8_timer(c, c->sound_end, c->cycles - 1)) c->sound_cycle = c->cycles - 1;
+					c->sound_end = chip8_ticks(c, c->cycles - 1) + c->V[(opcode & 0x0F00) >> 8];
+					c->pc += 2;
 					break;
 					
 				// FX1E 	MEM 	I +=Vx 	Adds VX to I.[3]
 				case 0x001E:
-					if(debug) printf("Opcode=0x%04X: FX1E I +=Vx\n", opcode);
-					I += V[(opcode & 0x0F00) >> 8];
-					pc += 2;
+					c->I += c->V[(opcode & 0x0F00) >> 8];
+					c->pc += 2;
 					break;	
 								
 				// FX29 	MEM 	I=sprite_addr[Vx] 	Sets I to the location of the sprite for the character in VX. 
 				case 0x0029:
-					if(debug) printf("Opcode=0x%04X: FX29 I=sprite_addr[Vx] \n", opcode);
-					I = 0x50 + (V[(opcode & 0x0F00) >> 8] * 5);
-					pc += 2;
+					c->I = 0x50 + (c->V[(opcode & 0x0F00) >> 8] * 5);
+					c->pc += 2;
 					break;	
 					
 				// FX33 	BCD 	set_BCD(Vx); Stores the binary-coded decimal representation of VX
 				case 0x0033:
-					if(debug) printf("Opcode=0x%04X: FX33 set_BCD(Vx);\n", opcode);
-					memory[I] = V[(opcode & 0x0F00) >> 8] / 100;
-					memory[I+1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-					memory[I+2] = (V[(opcode & 0x0F00) >> 8] % 100) % 10;
-					pc += 2;
+					chip8_write(c, c->I, c->V[(opcode & 0x0F00) >> 8] / 100);
+					chip8_write(c, c->I+1, (c->V[(opcode & 0x0F00) >> 8] / 10) % 10);
+					chip8_write(c, c->I+2, (c->V[(opcode & 0x0F00) >> 8] % 100) % 10);
+					c->pc += 2;
 					break;
 					
 				// FX55 	MEM 	reg_dump(Vx,&I) 	Stores V0 to VX (including VX) in memory starting at address I. 
 				// I is increased by 1 for each value written.
 				case 0x0055:
-					if(debug) printf("Opcode=0x%04X: FX55 reg_dump(Vx,&I)\n", opcode);
-					for(int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) memory[I+i] = V[i];
-					if(!cowgod) I += ((opcode & 0x0F00) >> 8) + 1;
-					pc += 2;
+					for(int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) chip8_write(c, c->I+i, c->V[i]);
+					if(!cowgod) c->I += ((opcode & 0x0F00) >> 8) + 1;
+					c->pc += 2;
 					break;	
 								
 				// FX65 	MEM 	reg_load(Vx,&I) 	Fills V0 to VX (including VX) with values from memory starting at address I. 
 				// I is increased by 1 for each value written.
 				case 0x0065:
-					if(debug) printf("Opcode=0x%04X: FX65 reg_load(Vx,&I)\n", opcode);
-					for(int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) V[i] = memory[I+i];
-					if(!cowgod) I += ((opcode & 0x0F00) >> 8) + 1;						
-					pc += 2;
+					for(int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) c->V[i] = c->memory[(c->I+i) & mask];
+					if(!cowgod) c->I += ((opcode & 0x0F00) >> 8) + 1;						
+					c->pc += 2;
 					break;	
 								
 				default:
-				printf ("pc=0x%X ERROR: unknown opcode: 0x%X\n", opcode);
+				chip8_unknown(c, opcode);
 			}
 			break;			
 
 		default:
-			printf ("pc=0x%X ERROR: unknown opcode: 0x%X\n", opcode);
+			chip8_unknown(c, opcode);
 	}
 		
 	// screen update status
 	return 0;
 }
 
-// update timer counts
-void chip8_timerupdate(void)
+// decoder and trace mask of the predecoded engine, below
+static void chip8_decode(chip8_op_t *op, unsigned short opcode, unsigned char mode);
+static unsigned short chip8_changed(const chip8_op_t *op, bool cowgod);
+
+// emulate a single cpu cycle, recording it in the trace if debug is enabled
+// always inlined, so the engine variants get it with their flags fixed
+static inline __attribute__((always_inline)) bool chip8_instruction(chip8_t *c, bool debug, bool screen_wrap, bool cowgod)
+{
+	PROFILE(chip8_profile_cycle(c));
+	if(!debug || c->trace == NULL) return chip8_execute(c, screen_wrap, cowgod);
+	
+	// state before the instruction
+	chip8_record_t r;
+	r.cycle = c->cycles;
+	r.pc = c->pc;
+	r.opcode = c->memory[c->pc & chip8_mask(c)] << 8 | c->memory[(c->pc + 1) & chip8_mask(c)];
+	r.I = c->I;
+	chip8_op_t op;
+	chip8_decode(&op, r.opcode, c->mode);
+	r.changed = chip8_changed(&op, cowgod);
+	r.sp = c->sp;
+	r.quirks = cowgod | screen_wrap << 1 | c->mode << 2;
+	unsigned long unknown = c->unknown;
+	
+	bool draw = chip8_execute(c, screen_wrap, cowgod);
+	
+	// registers after it
+	r.value = c->V[(r.opcode & 0x0F00) >> 8];
+	r.flag = c->V[0xF];
+	chip8_trace_add(c->trace, &r);
+	
+	// keep the trace leading up to the first unknown opcode it recorded
+	if(c->unknown != unknown && !c->trace->faulted)
+	{
+		c->trace->faulted = true;
+		chip8_trace_dump(c->trace, c, CHIP8_TRACE_FILE);
+	}
+	return draw;
+}
+
+// emulate a single cpu cycle, recording it in the trace if debug is enabled
+bool chip8_cycle(chip8_t *c, bool debug, bool screen_wrap, bool cowgod)
+{
+	return chip8_instruction(c, debug, screen_wrap, cowgod);
+}
+
+// predecoded instruction handlers
+enum
 {
-	// update delay timer	
-	if (delay_timer) delay_timer--;
+	OP_DECODE, OP_00E0, OP_00EE, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0,
+	OP_6XNN, OP_7XNN, OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5,
+	OP_8XY6, OP_8XY7, OP_8XYE, OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN,
+	OP_EX9E, OP_EXA1, OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29,
+	OP_FX33, OP_FX55, OP_FX65, OP_00CN, OP_00DN, OP_00FB, OP_00FC, OP_00FD,
+	OP_00FE, OP_00FF, OP_5XY2, OP_5XY3, OP_F000, OP_F002, OP_FN01, OP_FX30,
+	OP_FX3A, OP_FX75, OP_FX85, OP_UNKNOWN
+};
+
+// decode an opcode into a predecoded instruction, same matching as chip8_execute
+static void chip8_decode(chip8_op_t *op, unsigned short opcode, unsigned char mode)
+{
+	// 8XYN handlers by lowest nibble
+	static const unsigned char math[16] =
+	{
+		OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7,
+		OP_UNKNOWN, OP_UNKNOWN, OP_UNKNOWN, OP_UNKNOWN, OP_UNKNOWN, OP_UNKNOWN, OP_8XYE, OP_UNKNOWN
+	};
+	
+	// operands
+	op->x = (opcode & 0x0F00) >> 8;
+	op->y = (opcode & 0x00F0) >> 4;
+	op->nn = opcode & 0x00FF;
+	op->nnn = opcode & 0x0FFF;
+	op->opcode = opcode;
+	op->op = OP_UNKNOWN;
 	
-	// update sound timer
-	if (sound_timer)
+	// SCHIP and XO-CHIP opcodes
+	bool schip = mode != CHIP8_MODE_CHIP8, xo = mode == CHIP8_MODE_XOCHIP;
+	if(schip)
+	{
+		if((opcode & 0xFFF0) == 0x00C0) op->op = OP_00CN;
+		else if((opcode & 0xFFF0) == 0x00D0 && xo) op->op = OP_00DN;
+		else if(opcode == 0x00FB) op->op = OP_00FB;
+		else if(opcode == 0x00FC) op->op = OP_00FC;
+		else if(opcode == 0x00FD) op->op = OP_00FD;
+		else if(opcode == 0x00FE) op->op = OP_00FE;
+		else if(opcode == 0x00FF) op->op = OP_00FF;
+		else if((opcode & 0xF00F) == 0x5002 && xo) op->op = OP_5XY2;
+		else if((opcode & 0xF00F) == 0x5003 && xo) op->op = OP_5XY3;
+		else if(opcode == 0xF000 && xo) op->op = OP_F000;
+		else if(opcode == 0xF002 && xo) op->op = OP_F002;
+		else if((opcode & 0xF0FF) == 0xF001 && xo) op->op = OP_FN01;
+		else if((opcode & 0xF0FF) == 0xF03A && xo) op->op = OP_FX3A;
+		else if((opcode & 0xF0FF) == 0xF030) op->op = OP_FX30;
+		else if((opcode & 0xF0FF) == 0xF075) op->op = OP_FX75;
+		else if((opcode & 0xF0FF) == 0xF085) op->op = OP_FX85;
+		if(op->op != OP_UNKNOWN) return;
+	}
+	
+	// handler
+	switch(opcode & 0xF000)
+	{
+		case 0x0000:
+			if((opcode & 0x000F) == 0x0000) op->op = OP_00E0;
+			else if((opcode & 0x000F) == 0x000E) op->op = OP_00EE;
+			break;
+		case 0x1000: op->op = OP_1NNN; break;
+		case 0x2000: op->op = OP_2NNN; break;
+		case 0x3000: op->op = OP_3XNN; break;
+		case 0x4000: op->op = OP_4XNN; break;
+		case 0x5000: op->op = OP_5XY0; break;
+		case 0x6000: op->op = OP_6XNN; break;
+		case 0x7000: op->op = OP_7XNN; break;
+		case 0x8000: op->op = math[opcode & 0x000F]; break;
+		case 0x9000: op->op = OP_9XY0; break;
+		case 0xA000: op->op = OP_ANNN; break;
+		case 0xB000: op->op = OP_BNNN; break;
+		case 0xC000: op->op = OP_CXNN; break;
+		case 0xD000: op->op = OP_DXYN; break;
+		case 0xE000:
+			if((opcode & 0x000F) == 0x000E) op->op = OP_EX9E;
+			else if((opcode & 0x000F) == 0x0001) op->op = OP_EXA1;
+			break;
+		case 0xF000:
+			switch(opcode & 0x00FF)
+			{
+				case 0x0007: op->op = OP_FX07; break;
+				case 0x000A: op->op = OP_FX0A; break;
+				case 0x0015: op->op = OP_FX15; break;
+				case 0x0018: op->op = OP_FX18; break;
+				case 0x001E: op->op = OP_FX1E; break;
+				case 0x0029: op->op = OP_FX29; break;
+				case 0x0033: op->op = OP_FX33; break;
+				case 0x0055: op->op = OP_FX55; break;
+				case 0x0065: op->op = OP_FX65; break;
+			}
+			break;
+	}
+}
+
+// V registers a decoded instruction may write, as recorded in the trace
+static unsigned short chip8_changed(const chip8_op_t *op, bool cowgod)
+{
+	unsigned short x = 1 << op->x, f = 1 << 0xF;
+	switch(op->op)
 	{
-		if (sound_timer == 1) printf("Beep...\a\n"); // plays OS beep
-		sound_timer--;
+		case OP_6XNN: case OP_7XNN: case OP_8XY0: case OP_8XY1: case OP_8XY2: case OP_8XY3:
+		case OP_CXNN: case OP_FX07: case OP_FX0A:
+			return x;
+		case OP_8XY4: case OP_8XY5: case OP_8XY7:
+			return x | f;
+		case OP_8XY6: case OP_8XYE:
+			return x | f | (cowgod ? 0 : 1 << op->y);
+		case OP_DXYN:
+			return f;
+		case OP_FX65: case OP_FX85:
+			return (2 << op->x) - 1; // V0..Vx
+		case OP_5XY3:
+		{
+			int lo = op->x < op->y ? op->x : op->y, hi = op->x ^ op->y ^ lo;
+			return ((2 << hi) - 1) & ~((1 << lo) - 1); // Vx..Vy
+		}
 	}
+	return 0;
+}
+
+// mnemonics of the predecoded handlers, in OP_ order
+static const char *const chip8_opnames[] =
+{
+	"decode", "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0",
+	"6XNN", "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5",
+	"8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN",
+	"EX9E", "EXA1", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29",
+	"FX33", "FX55", "FX65", "00CN", "00DN", "00FB", "00FC", "00FD",
+	"00FE", "00FF", "5XY2", "5XY3", "F000", "F002", "FN01", "FX30",
+	"FX3A", "FX75", "FX85", "unknown"
+};
+
+// mnemonic of a predecoded handler
+const char *chip8_opname(unsigned char op)
+{
+	return op <= OP_UNKNOWN ? chip8_opnames[op] : "?";
 }
 
+#ifdef CHIP8_PROFILE
+// count the instruction at pc by its handler
+static void chip8_profile_cycle(chip8_t *c)
+{
+	unsigned short mask = chip8_mask(c);
+	chip8_op_t op;
+	chip8_decode(&op, c->memory[c->pc & mask] << 8 | c->memory[(c->pc + 1) & mask], c->mode);
+	c->profile->ops[op.op]++;
+	c->profile->pc[c->pc & 0xFFF]++;
+}
+#endif
+
+// follow a loop from address from until it is back at the backward jump at
+// address to, running only instructions that read memory and write V and I.
+// returns the number of instructions including the jump if that leaves V and I
+// as they were, which makes every further time around the same, 0 otherwise.
+static unsigned int chip8_spin(const chip8_t *c, unsigned short from, unsigned short to, unsigned char delay, bool cowgod)
+{
+	unsigned char V[16];
+	memcpy(V, c->V, sizeof(V));
+	unsigned short I = c->I;
+	unsigned short mask = chip8_mask(c);
+	unsigned int steps = 1;
+	for(unsigned short a = from; a != to; steps++)
+	{
+		if(a < from || a > to) return 0; // left the loop
+		unsigned short opcode = c->memory[a & mask] << 8 | c->memory[(a + 1) & mask];
+		unsigned char x = (opcode & 0x0F00) >> 8, y = (opcode & 0x00F0) >> 4, nn = opcode & 0x00FF;
+		unsigned short skip = chip8_skip(c, a) - 2;
+		a += 2;
+		switch(opcode & 0xF000)
+		{
+			case 0x3000: if(V[x] == nn) a += skip; break;
+			case 0x4000: if(V[x] != nn) a += skip; break;
+			case 0x5000:
+				if(c->mode == CHIP8_MODE_XOCHIP && ((opcode & 0x000F) == 0x2 || (opcode & 0x000F) == 0x3)) return 0;
+				if(V[x] == V[y]) a += skip;
+				break;
+			case 0x9000: if(V[x] != V[y]) a += skip; break;
+			case 0x6000: V[x] = nn; break;
+			case 0x7000: V[x] += nn; break;
+			case 0xA000: I = opcode & 0x0FFF; break;
+			case 0x8000:
+				// VF before Vx, as chip8_execute writes them
+				switch(opcode & 0x000F)
+				{
+					case 0x0: V[x] = V[y]; break;
+					case 0x1: V[x] |= V[y]; break;
+					case 0x2: V[x] &= V[y]; break;
+					case 0x3: V[x] ^= V[y]; break;
+					case 0x4: V[0xF] = V[x] + V[y] > 255; V[x] += V[y]; break;
+					case 0x5: V[0xF] = V[x] >= V[y]; V[x] -= V[y]; break;
+					case 0x7: V[0xF] = V[x] <= V[y]; V[x] = V[y] - V[x]; break;
+					case 0x6:
+						if(cowgod) { V[0xF] = V[x] & 1; V[x] >>= 1; }
+						else { V[0xF] = V[y] & 1; V[y] >>= 1; V[x] = V[y]; }
+						break;
+					case 0xE:
+						if(cowgod) { V[0xF] = V[x] >> 7; V[x] <<= 1; }
+						else { V[0xF] = V[y] >> 7; V[y] <<= 1; V[x] = V[y]; }
+						break;
+					default: return 0;
+				}
+				break;
+			case 0xE000:
+				if((opcode & 0x000F) == 0xE) { if(c->key[V[x] & 0xF]) a += skip; }
+				else if((opcode & 0x000F) == 0x1) { if(!c->key[V[x] & 0xF]) a += skip; }
+				else return 0;
+				break;
+			case 0xF000:
+				if(nn == 0x07) V[x] = delay;
+				else if(nn == 0x1E) I += V[x];
+				else if(nn == 0x29) I = 0x50 + V[x]*5;
+				else if(nn == 0x65)
+				{
+					for(int i = 0; i <= x; i++) V[i] = c->memory[(I + i) & mask];
+					if(!cowgod) I += x + 1;
+				}
+				else return 0;
+				break;
+			default:
+				return 0;
+		}
+	}
+	return memcmp(V, c->V, sizeof(V)) || I != c->I ? 0 : steps;
+}
+
+// ticks passed after cycles instructions, and the cycle count of the next tick
+static unsigned long long chip8_nexttick(const chip8_t *c, unsigned long long cycles, unsigned long long *next)
+{
+	unsigned long long ticks = chip8_ticks(c, cycles);
+	*next = c->tick_cycle + (ticks + 1 - c->tick_base)*c->rate/60;
+	return ticks;
+}
+
+// the predecoded engine, one variant per quirk combination, see chip8_run.h
+#define CHIP8_RUN chip8_run_plain
+#define RUN_WRAP false
+#define RUN_COWGOD false
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_run_cowgod
+#define RUN_WRAP false
+#define RUN_COWGOD true
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_run_wrap
+#define RUN_WRAP true
+#define RUN_COWGOD false
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_run_wrap_cowgod
+#define RUN_WRAP true
+#define RUN_COWGOD true
+#include "chip8_run.h"
+
+// the predecoded engine with an address map, for the basic block compiler
+#define CHIP8_RUN chip8_until_plain
+#define RUN_WRAP false
+#define RUN_COWGOD false
+#define RUN_UNTIL
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_until_cowgod
+#define RUN_WRAP false
+#define RUN_COWGOD true
+#define RUN_UNTIL
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_until_wrap
+#define RUN_WRAP true
+#define RUN_COWGOD false
+#define RUN_UNTIL
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_until_wrap_cowgod
+#define RUN_WRAP true
+#define RUN_COWGOD true
+#define RUN_UNTIL
+#include "chip8_run.h"
+
+// the predecoded engine recording every instruction, for debug
+#define CHIP8_RUN chip8_traced_plain
+#define RUN_WRAP false
+#define RUN_COWGOD false
+#define RUN_TRACE
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_traced_cowgod
+#define RUN_WRAP false
+#define RUN_COWGOD true
+#define RUN_TRACE
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_traced_wrap
+#define RUN_WRAP true
+#define RUN_COWGOD false
+#define RUN_TRACE
+#include "chip8_run.h"
+
+#define CHIP8_RUN chip8_traced_wrap_cowgod
+#define RUN_WRAP true
+#define RUN_COWGOD true
+#define RUN_TRACE
+#include "chip8_run.h"
+
+// engines by debug << 2 | screen_wrap << 1 | cowgod
+static const chip8_engine_t chip8_engines[8] =
+{
+	chip8_run_plain, chip8_run_cowgod, chip8_run_wrap, chip8_run_wrap_cowgod,
+	chip8_traced_plain, chip8_traced_cowgod, chip8_traced_wrap, chip8_traced_wrap_cowgod
+};
+
+// the engine specialized for a combination of debug and quirk flags
+chip8_engine_t chip8_engine(bool debug, bool screen_wrap, bool cowgod)
+{
+	return chip8_engines[debug << 2 | screen_wrap << 1 | cowgod];
+}
+
+// emulate n cpu cycles with predecoded instructions, in the variant for the quirks
+bool chip8_run(chip8_t *c, unsigned int n, bool screen_wrap, bool cowgod)
+{
+	return chip8_engines[screen_wrap << 1 | cowgod](c, n);
+}
+
+// emulate up to n cpu cycles like chip8_run, stopping where until says
+bool chip8_run_until(chip8_t *c, unsigned int n, bool screen_wrap, bool cowgod, const unsigned char *until)
+{
+	static bool (*const engines[4])(chip8_t *c, unsigned int n, const unsigned char *until) =
+	{
+		chip8_until_plain, chip8_until_cowgod, chip8_until_wrap, chip8_until_wrap_cowgod
+	};
+	return engines[screen_wrap << 1 | cowgod](c, n, until);
+}
+
+// hash of the current screen contents (FNV-1a over the packed rows)
+// only the visible part counts, the second bitplane only on XO-CHIP
+unsigned long long chip8_screenhash(const chip8_t *c)
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	int planes = c->mode == CHIP8_MODE_XOCHIP ? 2 : 1;
+	for(int p = 0; p < planes; p++)
+	{
+		for(int y = 0; y < chip8_height(c); y++)
+		{
+			for(int w = 0; w < chip8_width(c)/64; w++)
+			{
+				for(int i = 56; i >= 0; i -= 8)
+				{
+					hash ^= (c->screen[p][y][w] >> i) & 0xFF;
+					hash *= 0x100000001B3ULL;
+				}
+			}
+		}
+	}
+	return hash;
+}
+
+// current delay timer value
+unsigned char chip8_delay(const chip8_t *c)
+{
+	return chip8_timer(c, c->delay_end, c->cycles);
+}
+
+// sound timer running
+bool chip8_sound(const chip8_t *c)
+{
+	return chip8_timer(c, c->sound_end, c->cycles) != 0;
+}
+
+// set the number of instructions per second the timers count against
+void chip8_setrate(chip8_t *c, unsigned int rate)
+{
+	c->tick_base = chip8_ticks(c, c->cycles);
+	c->tick_cycle = c->cycles;
+	c->rate = rate ? rate : 1;
+}
+
+// save the machine state
+void chip8_save(const chip8_t *c, chip8_state_t *s)
+{
+	memset(s, 0, sizeof(chip8_state_t));
+	s->pc = c->pc;
+	s->I = c->I;
+	s->sp = c->sp;
+	s->opcode = c->opcode;
+	memcpy(s->V, c->V, sizeof(s->V));
+	s->keyflag = c->keyflag;
+	s->mode = c->mode;
+	s->hires = c->hires;
+	s->planes = c->planes;
+	s->delay_end = c->delay_end;
+	s->sound_end = c->sound_end;
+	s->sound_cycle = c->sound_cycle;
+	s->tick_cycle = c->tick_cycle;
+	s->tick_base = c->tick_base;
+	s->rate = c->rate;
+	memcpy(s->stack, c->stack, sizeof(s->stack));
+	s->rng = c->rng;
+	s->cycles = c->cycles;
+	memcpy(s->flags, c->flags, sizeof(s->flags));
+	memcpy(s->pattern, c->pattern, sizeof(s->pattern));
+	s->pitch = c->pitch;
+	memcpy(s->screen, c->screen, sizeof(s->screen));
+	memcpy(s->memory, c->memory, sizeof(s->memory));
+}
+
+// restore a saved machine state
+void chip8_restore(chip8_t *c, const chip8_state_t *s)
+{
+	c->pc = s->pc;
+	c->I = s->I;
+	c->sp = s->sp;
+	c->opcode = s->opcode;
+	memcpy(c->V, s->V, sizeof(c->V));
+	c->keyflag = s->keyflag;
+	c->mode = s->mode;
+	c->hires = s->hires;
+	c->planes = s->planes;
+	c->delay_end = s->delay_end;
+	c->sound_end = s->sound_end;
+	c->sound_cycle = s->sound_cycle;
+	c->tick_cycle = s->tick_cycle;
+	c->tick_base = s->tick_base;
+	c->rate = s->rate;
+	memcpy(c->stack, s->stack, sizeof(c->stack));
+	c->rng = s->rng;
+	c->cycles = s->cycles;
+	memcpy(c->flags, s->flags, sizeof(c->flags));
+	memcpy(c->pattern, s->pattern, sizeof(c->pattern));
+	c->pitch = s->pitch;
+	memcpy(c->screen, s->screen, sizeof(c->screen));
+	memcpy(c->memory, s->memory, sizeof(c->memory));
+	
+	// memory may hold different code now
+	memset(c->decoded, 0, sizeof(c->decoded));
+	memset(c->written, 0xFF, sizeof(c->written));
+}
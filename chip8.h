@@ -5,9 +5,107 @@ CHIP-8 cpu interpreter.
 (c) 2018 Jos van Mourik
 ******************************************************************************/
 
-// extern variables to be used with SDL
-extern unsigned char screen[64][32];// screen
-extern unsigned char key[16]; // input
+// predecoded instruction, one per 2-byte slot of memory
+typedef struct chip8_op_t
+{
+	unsigned char op; // handler, 0 = not decoded yet
+	unsigned char x; // register X
+	unsigned char y; // register Y
+	unsigned char nn; // constant NN, N is the lowest nibble
+	unsigned short nnn; // address NNN
+	unsigned short opcode; // raw opcode
+} chip8_op_t;
+
+// machine variants, chosen with chip8_setmode before a rom is loaded
+// SUPER-CHIP adds the 128x64 screen, scrolling, 16x16 sprites and the big
+// font, XO-CHIP on top of that two bitplanes, 64KB memory and 16-bit I.
+enum { CHIP8_MODE_CHIP8, CHIP8_MODE_SCHIP, CHIP8_MODE_XOCHIP };
+
+// CHIP-8 machine context
+// all state of one machine lives here, so any number of machines can run
+// side by side. fields touched on every cycle are kept together at the top
+// so the cpu state shares one or two cache lines, the bulky screen and
+// memory arrays come last.
+typedef struct chip8_t
+{
+	// hot cpu state
+	unsigned short pc; // program counter
+	unsigned short I; // index register
+	unsigned short sp; // stack pointer
+	unsigned short opcode; // current opcode
+	unsigned char V[16]; // data register
+	unsigned char key[16]; // input
+	unsigned char keyflag; // flag for input update used in FX0A
+	unsigned char mode; // machine variant, CHIP8_MODE_*
+	bool hires; // 128x64 screen instead of 64x32 (SCHIP)
+	unsigned char planes; // bitplanes drawn to, bit 0 = plane 0 (XO-CHIP)
+	
+	// call stack
+	unsigned short stack[16]; // stack
+	
+	// timers, kept as the 60Hz tick they run out at. ticks are not counted
+	// by the host but derived from the cycle counter: rate instructions take
+	// one second, so the timers can be read at any cycle.
+	unsigned long long delay_end; // tick at which the delay timer reaches 0
+	unsigned long long sound_end; // tick at which the sound timer reaches 0
+	unsigned long long sound_cycle; // cycle at which FX18 last started the sound
+	unsigned long long tick_cycle; // cycle count from which ticks are counted
+	unsigned long long tick_base; // ticks before tick_cycle
+	unsigned int rate; // instructions per second
+	
+	// random number generator state and statistics
+	unsigned long long rng; // CXNN random number generator state
+	unsigned long long cycles; // executed instructions
+	unsigned long unknown; // unknown opcodes encountered
+	bool quiet; // suppress status and error output
+	struct chip8_trace_t *trace; // execution trace written by chip8_cycle in debug mode, NULL = off
+	struct chip8_profile_t *profile; // counters kept by chip8_cycle and chip8_run when built with CHIP8_PROFILE, NULL = off
+	unsigned long long written[4]; // 256-byte memory blocks changed since chip8_fork last cleared them, bit b%64 of word b/64
+	
+	// SCHIP and XO-CHIP extras
+	unsigned char flags[16]; // RPL user flags of FX75/FX85, kept over a reset
+	unsigned char pattern[16]; // audio pattern of F002 (XO-CHIP)
+	unsigned char pitch; // audio pitch of FX3A (XO-CHIP)
+	
+	// screen and program memory
+	// a screen row is two words, pixels 0-63 and 64-127 with the leftmost in
+	// the highest bit. the 64x32 screen uses the first word of rows 0-31.
+	// memory comes last, keeping the predecoded slots close to the registers.
+	unsigned long long screen[2][64][2]; // bitplanes
+	chip8_op_t decoded[2048]; // predecoded instructions of the first 4KB
+	unsigned char memory[65536]; // program memory, 4KB before XO-CHIP
+} chip8_t;
+
+// saved machine state
+// everything that determines how the machine continues, without derived data
+// (predecoded instructions) and host input. padding is zeroed by chip8_save so
+// two states can be compared or XORed byte for byte.
+typedef struct chip8_state_t
+{
+	unsigned short pc; // program counter
+	unsigned short I; // index register
+	unsigned short sp; // stack pointer
+	unsigned short opcode; // current opcode
+	unsigned char V[16]; // data register
+	unsigned char keyflag; // flag for input update used in FX0A
+	unsigned char mode; // machine variant
+	bool hires; // 128x64 screen
+	unsigned char planes; // bitplanes drawn to
+	unsigned short stack[16]; // stack
+	unsigned long long delay_end; // tick at which the delay timer reaches 0
+	unsigned long long sound_end; // tick at which the sound timer reaches 0
+	unsigned long long sound_cycle; // cycle at which FX18 last started the sound
+	unsigned long long tick_cycle; // cycle count from which ticks are counted
+	unsigned long long tick_base; // ticks before tick_cycle
+	unsigned int rate; // instructions per second
+	unsigned long long rng; // CXNN random number generator state
+	unsigned long long cycles; // executed instructions
+	unsigned char flags[16]; // RPL user flags
+	unsigned char pattern[16]; // audio pattern
+	unsigned char pitch; // audio pitch
+	unsigned long long screen[2][64][2]; // bitplanes
+	unsigned char memory[65536]; // program memory
+} chip8_state_t;
 
 // CHIP-8 built-in fontset
 static const unsigned char chip8_fontset[80] =
@@ -30,15 +128,123 @@ static const unsigned char chip8_fontset[80] =
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// SCHIP big fontset, 8x10 digits (A-F from XO-CHIP)
+static const unsigned char chip8_bigfont[160] =
+{
+	0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+	0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+	0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+	0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+	0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+// 60Hz ticks that have passed after cycles instructions
+// tick j happens once tick_cycle + j*rate/60 (rounded down) instructions ran
+static inline unsigned long long chip8_ticks(const chip8_t *c, unsigned long long cycles)
+{
+	return c->tick_base + ((cycles - c->tick_cycle + 1)*60 - 1)/c->rate;
+}
+
+// timer value after cycles instructions
+static inline unsigned char chip8_timer(const chip8_t *c, unsigned long long end, unsigned long long cycles)
+{
+	unsigned long long now = chip8_ticks(c, cycles);
+	return end > now ? end - now : 0;
+}
+
+// screen size in the current resolution
+static inline int chip8_width(const chip8_t *c)
+{
+	return c->hires ? 128 : 64;
+}
+static inline int chip8_height(const chip8_t *c)
+{
+	return c->hires ? 64 : 32;
+}
+
+// color at screen coordinate x, y: bit 0 from plane 0, bit 1 from plane 1
+static inline int chip8_pixel(const chip8_t *c, int x, int y)
+{
+	int shift = 63 - (x & 63);
+	return (c->screen[0][y][x >> 6] >> shift & 1) | (c->screen[1][y][x >> 6] >> shift & 1) << 1;
+}
+
 // initialize all memory and registers
-void chip8_init(void);
+void chip8_init(chip8_t *c);
+
+// select the machine variant, before loading a rom
+void chip8_setmode(chip8_t *c, unsigned char mode);
+
+// memory size of a machine variant
+size_t chip8_memsize(unsigned char mode);
+
+// build the memory contents of a machine variant after loading a rom
+// (fontsets and the rom at 0x200) in chip8_memsize(mode) bytes of image,
+// returns 1 if the rom doesn't fit
+bool chip8_image(unsigned char *image, unsigned char mode, const unsigned char *rom, size_t len);
 
 // load rom file into memory
-bool chip8_load(char* rom);
+bool chip8_load(chip8_t *c, char* rom);
+
+// load rom image from a buffer into memory
+bool chip8_loadbuffer(chip8_t *c, const unsigned char *rom, size_t len);
+
+// seed the random number generator used by CXNN
+void chip8_seed(chip8_t *c, unsigned long long seed);
+
+// emulate a single cpu cycle, debug records it in the trace
+bool chip8_cycle(chip8_t *c, bool debug, bool screen_wrap, bool cowgod);
+
+// emulate n cpu cycles with predecoded instructions, without debug output
+bool chip8_run(chip8_t *c, unsigned int n, bool screen_wrap, bool cowgod);
+
+// address flags for chip8_run_until
+#define CHIP8_UNTIL_RUN 1 // the interpreter may run the instruction at this address
+#define CHIP8_UNTIL_CODE 2 // a write to this address ends the run
+
+// emulate up to n cpu cycles like chip8_run, but return before an
+// instruction at an address a without CHIP8_UNTIL_RUN in until[a & 0xFFF]
+// (never before the first) and after one that wrote to an address with
+// CHIP8_UNTIL_CODE. the cycle count tells how many ran.
+bool chip8_run_until(chip8_t *c, unsigned int n, bool screen_wrap, bool cowgod, const unsigned char *until);
+
+// an engine built for one combination of debug and quirk flags: emulate n
+// cpu cycles, returns 1 if the screen changed
+typedef bool (*chip8_engine_t)(chip8_t *c, unsigned int n);
+
+// the engine for debug and quirk flags, to pick again when they change.
+// without debug it is chip8_run, with debug chip8_cycle recording the trace.
+chip8_engine_t chip8_engine(bool debug, bool screen_wrap, bool cowgod);
+
+// mnemonic of a predecoded instruction handler, as counted by the profiler
+const char *chip8_opname(unsigned char op);
+
+// hash of the current screen contents
+unsigned long long chip8_screenhash(const chip8_t *c);
+
+// current delay timer value
+unsigned char chip8_delay(const chip8_t *c);
+
+// sound timer running
+bool chip8_sound(const chip8_t *c);
+
+// set the number of instructions per second the timers count against
+void chip8_setrate(chip8_t *c, unsigned int rate);
 
-// emulate a single cpu cycle
-bool chip8_cycle(bool debug, bool screen_wrap, bool cowgod);
+// save the machine state
+void chip8_save(const chip8_t *c, chip8_state_t *s);
 
-// update timer counts
-void chip8_timerupdate(void);
+// restore a saved machine state, a compiler for this machine must be flushed
+void chip8_restore(chip8_t *c, const chip8_state_t *s);
 
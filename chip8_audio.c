@@ -0,0 +1,127 @@
+/******************************************************************************
+chip8_audio.c
+CHIP-8 sound: samples of the sound timer, from the emulation thread to the
+audio device through a lock-free ring.
+
+Samples are made for emulated time, not host time: sample s sounds at cycle
+s*rate/freq, so a beep starts at the very instruction that started it and
+lasts exactly as many ticks as the timer says. The ring holds at most limit
+samples, the emulation thread drops what doesn't fit instead of letting the
+sound fall behind, which keeps the latency at about one tick plus the
+device buffer.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "chip8_audio.h"
+
+// square wave frequency and the volume of both waves
+#define AUDIO_TONE 440
+#define AUDIO_VOLUME 4000
+
+// create the sound for freq samples per second with at most limit samples queued
+chip8_audio_t *chip8_audio_create(unsigned int freq, unsigned int limit, bool pattern)
+{
+	chip8_audio_t *a = calloc(1, sizeof(chip8_audio_t));
+	if(a == NULL) return NULL;
+	unsigned int size = 1;
+	while(size < limit) size *= 2;
+	a->ring = malloc(size*sizeof(short));
+	if(a->ring == NULL)
+	{
+		free(a);
+		return NULL;
+	}
+	a->mask = size - 1;
+	a->limit = limit;
+	a->freq = freq;
+	a->pattern = pattern;
+	atomic_init(&a->head, 0);
+	atomic_init(&a->tail, 0);
+	atomic_init(&a->dropped, 0);
+	atomic_init(&a->underruns, 0);
+	return a;
+}
+
+// release the sound
+void chip8_audio_destroy(chip8_audio_t *a)
+{
+	free(a->ring);
+	free(a);
+}
+
+// make the samples of the instructions the machine ran since cycle start
+void chip8_audio_generate(chip8_audio_t *a, const chip8_t *c, unsigned long long start)
+{
+	// samples that fall between start and now
+	unsigned long long first = (start*a->freq + c->rate - 1)/c->rate;
+	unsigned long long end = (c->cycles*a->freq + c->rate - 1)/c->rate;
+
+	// wave position per sample: XO-CHIP plays the 128 bit pattern at
+	// 4000*2^((pitch-64)/48) bits per second, otherwise a square wave
+	bool pattern = a->pattern && c->mode == CHIP8_MODE_XOCHIP;
+	double period = pattern ? 128 : 1, step = (double)AUDIO_TONE/a->freq;
+	if(pattern)
+	{
+		double bits = 4000;
+		for(int p = 64; p < c->pitch; p++) bits *= 1.0145453349375237; // 2^(1/48)
+		for(int p = c->pitch; p < 64; p++) bits /= 1.0145453349375237;
+		step = bits/a->freq;
+	}
+
+	unsigned int head = atomic_load_explicit(&a->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+	for(unsigned long long s = first; s < end; s++)
+	{
+		// sound timer at the cycle of this sample
+		unsigned long long cycle = s*c->rate/a->freq;
+		short v = 0;
+		if(cycle >= c->sound_cycle && chip8_timer(c, c->sound_end, cycle))
+		{
+			int bit = a->phase;
+			if(pattern) v = c->pattern[bit >> 3] >> (7 - (bit & 7)) & 1 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+			else v = a->phase < 0.5 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+			a->phase += step;
+			if(a->phase >= period) a->phase -= period;
+		}
+		else a->phase = 0; // every beep starts at the start of the wave
+
+		// drop the sample if the reader is too far behind
+		if(head - tail >= a->limit)
+		{
+			tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+			if(head - tail >= a->limit)
+			{
+				atomic_fetch_add_explicit(&a->dropped, 1, memory_order_relaxed);
+				continue;
+			}
+		}
+		a->ring[head & a->mask] = v;
+		head++;
+	}
+	atomic_store_explicit(&a->head, head, memory_order_release);
+}
+
+// take n samples, silence where there are none
+void chip8_audio_read(chip8_audio_t *a, short *out, unsigned int n)
+{
+	unsigned int tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&a->head, memory_order_acquire);
+	unsigned int i = 0;
+	for(; i < n && tail != head; i++) out[i] = a->ring[tail++ & a->mask];
+	atomic_store_explicit(&a->tail, tail, memory_order_release);
+
+	// ran dry while playing, paused emulation makes no samples at all
+	if(i < n)
+	{
+		memset(out + i, 0, (n - i)*sizeof(short));
+		if(i) atomic_fetch_add_explicit(&a->underruns, 1, memory_order_relaxed);
+	}
+}
@@ -0,0 +1,40 @@
+/******************************************************************************
+chip8_audio.h
+CHIP-8 sound: samples of the sound timer, from the emulation thread to the
+audio device through a lock-free ring.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// sound of one machine
+// there is one writer, the emulation thread, and one reader, the audio
+// callback. each only ever moves its own end of the ring and publishes it
+// after touching the samples.
+typedef struct chip8_audio_t
+{
+	_Atomic unsigned int head; // samples written
+	_Atomic unsigned int tail; // samples read
+	unsigned int mask; // ring size - 1
+	unsigned int limit; // samples queued at most, bounds the latency
+	short *ring; // samples
+	unsigned int freq; // samples per second
+	bool pattern; // play the XO-CHIP pattern buffer instead of a square wave
+	double phase; // position in the square wave period or the 128 bit pattern
+	_Atomic unsigned long dropped; // samples dropped because the ring was full
+	_Atomic unsigned long underruns; // reads that found too few samples
+} chip8_audio_t;
+
+// create the sound for freq samples per second with at most limit samples
+// queued, returns NULL if out of memory
+chip8_audio_t *chip8_audio_create(unsigned int freq, unsigned int limit, bool pattern);
+
+// release the sound
+void chip8_audio_destroy(chip8_audio_t *a);
+
+// make the samples of the instructions the machine ran since cycle start
+// (emulation thread). the sound starts at the FX18 that started it and stops
+// at the tick the sound timer runs out.
+void chip8_audio_generate(chip8_audio_t *a, const chip8_t *c, unsigned long long start);
+
+// take n samples, silence where there are none (audio callback)
+void chip8_audio_read(chip8_audio_t *a, short *out, unsigned int n);
@@ -0,0 +1,378 @@
+/******************************************************************************
+chip8_capture.c
+CHIP-8 frame capture: the screens of a session, from the emulation thread to
+a video file or an encoder through a lock-free queue and a writer thread.
+
+The emulation thread copies the screen into a slot of a ring of frames after
+every tick that changed it, and that is all it does: a single producer
+single consumer queue like the audio ring, no locks and no system calls. A
+writer thread takes the frames, XORs each with the one before and writes
+the changed bytes as runs, a few bytes for a moving sprite. When the writer
+falls behind and the ring is full, the newest frame waits outside it and a
+newer one replaces it, so the emulation never waits and the frames that go
+missing are counted.
+
+For an encoder the writer upscales the frames with chip8_scale, only the
+rows that changed, and writes them as raw RGB at a steady 60 frames per
+second: a frame is repeated for every tick it stayed on the screen.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <signal.h>
+#endif
+#include "chip8.h"
+#include "chip8_scale.h"
+#include "chip8_capture.h"
+
+// frames the queue holds
+#define CAPTURE_SLOTS 64
+
+// largest encoded frame: one run over all bytes of the bitplanes
+#define CAPTURE_DELTA (sizeof(((chip8_t*)0)->screen) + 16)
+
+// a captured screen
+typedef struct capture_frame_t
+{
+	unsigned long long cycles; // instruction count
+	bool hires; // 128x64 screen
+	unsigned long long screen[2][64][2]; // bitplanes
+} capture_frame_t;
+
+// capture of one session
+struct chip8_capture_t
+{
+	// queue with one writer, the emulation thread, and one reader, the
+	// writer thread. each only moves its own end and publishes it after
+	// touching the frame.
+	capture_frame_t slots[CAPTURE_SLOTS]; // ring of frames
+	_Atomic unsigned int head; // frames queued
+	_Atomic unsigned int tail; // frames taken
+	capture_frame_t waiting; // newest frame while the ring is full
+	bool held; // waiting holds a frame
+	_Atomic bool stop; // no frames come any more
+	pthread_t thread; // writer thread
+
+	// output, used by the writer thread
+	FILE *file; // capture file, NULL = none or failed
+	FILE *pipe; // encoder, NULL = none or failed
+	unsigned int rate; // instructions per second
+	unsigned int factor, filter; // upscaling of piped frames
+	capture_frame_t last; // frame written before, blank at first
+	bool started; // a frame was written
+	bool error; // an output failed
+	unsigned char delta[CAPTURE_DELTA]; // encoded frame
+	unsigned int *picture; // upscaled frame, 64*factor by 32*factor
+	unsigned char *rgb; // upscaled frame as RGB
+	unsigned int width, height; // picture size
+
+	// counters, see chip8_capturestats_t
+	_Atomic unsigned long long frames, written, coalesced, dropped, bytes;
+};
+
+// colors of piped frames, as in the window
+static const unsigned int capture_palette[4] = CHIP8_SCALE_PALETTE;
+
+// wait a little for frames (writer thread)
+static void capture_sleep(void)
+{
+#ifdef _WIN32
+	Sleep(1);
+#else
+	struct timespec ts = {0, 1000000};
+	nanosleep(&ts, NULL);
+#endif
+}
+
+// write an unsigned varint
+static unsigned char *capture_putvar(unsigned char *p, unsigned long long v)
+{
+	while(v >= 0x80)
+	{
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+// encode the XOR of two screens as (unchanged, changed, bytes) runs
+static size_t capture_delta(unsigned char *out, const void *a, const void *b)
+{
+	const unsigned char *x = a, *y = b;
+	size_t n = sizeof(((capture_frame_t*)0)->screen);
+	unsigned char *p = out;
+	size_t i = 0;
+	while(i < n)
+	{
+		// unchanged bytes, compared a word at a time
+		size_t start = i;
+		while(i + 8 <= n)
+		{
+			unsigned long long u, v;
+			memcpy(&u, x + i, 8);
+			memcpy(&v, y + i, 8);
+			if(u != v) break;
+			i += 8;
+		}
+		while(i < n && x[i] == y[i]) i++;
+		if(i == n) break;
+		size_t skip = i - start;
+
+		// changed bytes, short unchanged gaps are cheaper to keep in the run
+		size_t end = i;
+		while(end < n)
+		{
+			if(x[end] != y[end]) end++;
+			else if(end + 2 < n && (x[end+1] != y[end+1] || x[end+2] != y[end+2])) end++;
+			else break;
+		}
+		p = capture_putvar(p, skip);
+		p = capture_putvar(p, end - i);
+		for(; i < end; i++) *p++ = x[i] ^ y[i];
+	}
+	return p - out;
+}
+
+// write a frame to the capture file, returns 1 on error
+static bool capture_file(chip8_capture_t *cap, const capture_frame_t *f)
+{
+	unsigned char head[24];
+	unsigned char *p = capture_putvar(head, f->cycles << 1 | f->hires);
+	size_t size = capture_delta(cap->delta, f->screen, cap->last.screen);
+	p = capture_putvar(p, size);
+	bool error = fwrite(head, 1, p - head, cap->file) != (size_t)(p - head) || fwrite(cap->delta, 1, size, cap->file) != size;
+	atomic_fetch_add_explicit(&cap->bytes, (p - head) + size, memory_order_relaxed);
+	return error;
+}
+
+// write the picture to the encoder count times, returns 1 on error
+static bool capture_repeat(chip8_capture_t *cap, unsigned long long count)
+{
+	size_t size = (size_t)cap->width*cap->height*3;
+	for(; count; count--) if(fwrite(cap->rgb, 1, size, cap->pipe) != size) return 1;
+	return 0;
+}
+
+// upscale a frame into the picture, centered, and convert the rows that changed
+static void capture_picture(chip8_capture_t *cap, const capture_frame_t *f)
+{
+	unsigned int width, height, top;
+	chip8_scale_size(f->hires, cap->factor, cap->filter, &width, &height);
+	unsigned int x = (cap->width - width)/2, y = (cap->height - height)/2;
+
+	// the other resolution leaves a different border, start over
+	bool same = cap->started && cap->last.hires == f->hires;
+	if(!same) for(size_t i = 0; i < (size_t)cap->width*cap->height; i++) cap->picture[i] = capture_palette[0];
+	unsigned int rows = chip8_scale(cap->picture + (size_t)y*cap->width + x, cap->width*sizeof(unsigned int), &f->screen[0][0][0],
+		same ? &cap->last.screen[0][0][0] : NULL, f->hires, cap->factor, cap->filter, capture_palette, &top);
+	size_t from = same ? y + top : 0, to = same ? y + top + rows : cap->height;
+
+	// ARGB to RGB bytes
+	for(size_t i = from*cap->width; i < to*cap->width; i++)
+	{
+		cap->rgb[3*i] = cap->picture[i] >> 16;
+		cap->rgb[3*i + 1] = cap->picture[i] >> 8;
+		cap->rgb[3*i + 2] = cap->picture[i];
+	}
+}
+
+// write a frame to the outputs, an output that fails is closed
+static void capture_write(chip8_capture_t *cap, const capture_frame_t *f)
+{
+	if(cap->file && capture_file(cap, f))
+	{
+		fclose(cap->file);
+		cap->file = NULL;
+		cap->error = true;
+	}
+	if(cap->pipe)
+	{
+		// the frame before stays on screen up to the tick of this one, later
+		// frames of the same tick replace it. after a reset the count starts over.
+		unsigned long long ticks = 0;
+		if(cap->started) ticks = f->cycles < cap->last.cycles ? 1 : f->cycles*60/cap->rate - cap->last.cycles*60/cap->rate;
+		if(capture_repeat(cap, ticks))
+		{
+			pclose(cap->pipe);
+			cap->pipe = NULL;
+			cap->error = true;
+		}
+		else capture_picture(cap, f);
+	}
+	atomic_fetch_add_explicit(cap->file || cap->pipe ? &cap->written : &cap->dropped, 1, memory_order_relaxed);
+	cap->last = *f;
+	cap->started = true;
+}
+
+// writer thread: writes queued frames until stopped and the queue is empty
+static void *capture_main(void *data)
+{
+	chip8_capture_t *cap = data;
+	for(;;)
+	{
+		bool stop = atomic_load_explicit(&cap->stop, memory_order_acquire);
+		unsigned int tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+		if(tail == atomic_load_explicit(&cap->head, memory_order_acquire))
+		{
+			if(stop) break;
+			capture_sleep();
+			continue;
+		}
+		capture_write(cap, &cap->slots[tail % CAPTURE_SLOTS]);
+		atomic_store_explicit(&cap->tail, tail + 1, memory_order_release);
+	}
+
+	// the last frame stays on screen for one tick
+	if(cap->pipe && cap->started && capture_repeat(cap, 1)) cap->error = true;
+	return NULL;
+}
+
+// start capturing the frames of a machine
+chip8_capture_t *chip8_capture_create(unsigned char mode, unsigned int rate, const char *file, const char *command, unsigned int factor, unsigned int filter)
+{
+	chip8_capture_t *cap = calloc(1, sizeof(chip8_capture_t));
+	if(cap == NULL) return NULL;
+	atomic_init(&cap->head, 0);
+	atomic_init(&cap->tail, 0);
+	atomic_init(&cap->stop, false);
+	atomic_init(&cap->frames, 0);
+	atomic_init(&cap->written, 0);
+	atomic_init(&cap->coalesced, 0);
+	atomic_init(&cap->dropped, 0);
+	atomic_init(&cap->bytes, 0);
+	cap->rate = rate ? rate : 1;
+	cap->factor = factor ? factor : 1;
+	cap->filter = filter;
+
+	// capture file with its header
+	if(file)
+	{
+		chip8_capturefile_t h = {{'J', '8', 'V', 'D'}, mode, {0}, rate};
+		cap->file = fopen(file, "wb");
+		if(cap->file == NULL || fwrite(&h, sizeof(h), 1, cap->file) != 1) goto fail;
+		atomic_store(&cap->bytes, sizeof(h));
+	}
+
+	// encoder, a closed pipe shows up as a write error instead of a signal
+	if(command)
+	{
+		cap->width = 64*cap->factor;
+		cap->height = 32*cap->factor;
+		cap->picture = malloc((size_t)cap->width*cap->height*sizeof(unsigned int));
+		cap->rgb = malloc((size_t)cap->width*cap->height*3);
+		if(cap->picture == NULL || cap->rgb == NULL) goto fail;
+#ifdef _WIN32
+		cap->pipe = popen(command, "wb");
+#else
+		signal(SIGPIPE, SIG_IGN);
+		cap->pipe = popen(command, "w");
+#endif
+		if(cap->pipe == NULL) goto fail;
+	}
+
+	if(pthread_create(&cap->thread, NULL, capture_main, cap)) goto fail;
+	return cap;
+
+fail:
+	if(cap->file) fclose(cap->file);
+	if(cap->pipe) pclose(cap->pipe);
+	free(cap->picture);
+	free(cap->rgb);
+	free(cap);
+	return NULL;
+}
+
+// free slot of the queue, NULL if it is full
+static capture_frame_t *capture_slot(chip8_capture_t *cap)
+{
+	unsigned int head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&cap->tail, memory_order_acquire) == CAPTURE_SLOTS) return NULL;
+	return &cap->slots[head % CAPTURE_SLOTS];
+}
+
+// queue the frame written into the free slot
+static void capture_queue(chip8_capture_t *cap)
+{
+	atomic_fetch_add_explicit(&cap->head, 1, memory_order_release);
+}
+
+// hand the machine's screen to the writer
+void chip8_capture_frame(chip8_capture_t *cap, const chip8_t *c)
+{
+	atomic_fetch_add_explicit(&cap->frames, 1, memory_order_relaxed);
+
+	// a frame waiting for room goes first
+	capture_frame_t *f;
+	if(cap->held && (f = capture_slot(cap)))
+	{
+		*f = cap->waiting;
+		capture_queue(cap);
+		cap->held = false;
+	}
+
+	// no room: wait outside the queue, replacing a frame waiting there
+	f = cap->held ? NULL : capture_slot(cap);
+	if(f == NULL)
+	{
+		if(cap->held) atomic_fetch_add_explicit(&cap->coalesced, 1, memory_order_relaxed);
+		f = &cap->waiting;
+		cap->held = true;
+	}
+	f->cycles = c->cycles;
+	f->hires = c->hires;
+	memcpy(f->screen, c->screen, sizeof(f->screen));
+	if(f != &cap->waiting) capture_queue(cap);
+}
+
+// counters of a capture
+void chip8_capture_stats(chip8_capture_t *cap, chip8_capturestats_t *stats)
+{
+	stats->frames = atomic_load_explicit(&cap->frames, memory_order_relaxed);
+	stats->written = atomic_load_explicit(&cap->written, memory_order_relaxed);
+	stats->coalesced = atomic_load_explicit(&cap->coalesced, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&cap->dropped, memory_order_relaxed);
+	stats->bytes = atomic_load_explicit(&cap->bytes, memory_order_relaxed);
+}
+
+// write the frames still queued and release the capture
+bool chip8_capture_destroy(chip8_capture_t *cap, chip8_capturestats_t *stats)
+{
+	// the waiting frame, once there is room for it
+	while(cap->held)
+	{
+		capture_frame_t *f = capture_slot(cap);
+		if(f == NULL)
+		{
+			capture_sleep();
+			continue;
+		}
+		*f = cap->waiting;
+		capture_queue(cap);
+		cap->held = false;
+	}
+	atomic_store_explicit(&cap->stop, true, memory_order_release);
+	pthread_join(cap->thread, NULL);
+
+	bool error = cap->error;
+	if(cap->file && fclose(cap->file)) error = true;
+	if(cap->pipe && pclose(cap->pipe)) error = true;
+	if(stats) chip8_capture_stats(cap, stats);
+	free(cap->picture);
+	free(cap->rgb);
+	free(cap);
+	return error;
+}
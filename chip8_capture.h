@@ -0,0 +1,59 @@
+/******************************************************************************
+chip8_capture.h
+CHIP-8 frame capture: the screens of a session, from the emulation thread to
+a video file or an encoder through a lock-free queue and a writer thread.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// default capture file
+#define CHIP8_CAPTURE_FILE "Jos8-video.bin"
+
+// capture file header, followed by the frames until the end of the file.
+// each frame is a varint of its instruction count since the last reset
+// shifted left by 1 with hires in the low bit, a varint of the size of its
+// delta, then the delta: the XOR of its bitplanes (2 planes of 64 rows of 2
+// words, little endian, as chip8_t holds them) with those of the frame
+// before as runs of a varint of unchanged bytes, a varint of changed bytes
+// and the changed bytes. the first frame is XORed with a blank screen.
+typedef struct chip8_capturefile_t
+{
+	char magic[4]; // "J8VD"
+	unsigned char mode; // machine variant
+	unsigned char reserved[3];
+	unsigned int rate; // instructions per second, frames are timed by instruction count
+} chip8_capturefile_t;
+
+// capture of one session
+typedef struct chip8_capture_t chip8_capture_t;
+
+// what became of the frames handed to a capture
+typedef struct chip8_capturestats_t
+{
+	unsigned long long frames; // frames handed to chip8_capture_frame
+	unsigned long long written; // frames written
+	unsigned long long coalesced; // frames replaced by a newer one while the queue was full
+	unsigned long long dropped; // frames that could not be written
+	unsigned long long bytes; // size of the capture file
+} chip8_capturestats_t;
+
+// start capturing the frames of a machine of mode (CHIP8_MODE_*) running
+// rate instructions per second into file, and/or as raw 8-bit RGB images
+// piped to the standard input of command (an encoder reading 60 frames per
+// second of 64*factor by 32*factor pixels, upscaled as chip8_scale does with
+// filter). either can be NULL. returns NULL if the file or the command can't
+// be opened or out of memory.
+chip8_capture_t *chip8_capture_create(unsigned char mode, unsigned int rate, const char *file, const char *command, unsigned int factor, unsigned int filter);
+
+// hand the machine's screen to the writer after a tick that changed it
+// (emulation thread). never waits: if the writer is behind and the queue is
+// full, the frame waits outside it and a newer one replaces it.
+void chip8_capture_frame(chip8_capture_t *cap, const chip8_t *c);
+
+// counters of a capture, any thread
+void chip8_capture_stats(chip8_capture_t *cap, chip8_capturestats_t *stats);
+
+// write the frames still queued, close the file and the encoder and release
+// the capture, stats are set if not NULL (emulation thread). returns 1 if a
+// frame couldn't be written.
+bool chip8_capture_destroy(chip8_capture_t *cap, chip8_capturestats_t *stats);
@@ -0,0 +1,175 @@
+/******************************************************************************
+chip8_fork.c
+CHIP-8 state trees: machine states that share their memory and screen
+copy-on-write, for searches that branch from a state many times.
+
+A node keeps memory and screen as 256-byte blocks. Forking a machine into a
+child of the node it was loaded from shares every block it didn't change:
+the interpreter marks the memory blocks it writes, and the 2KB screen is
+compared block by block. A child costs its registers, the pointers and the
+blocks it changed, most ROMs only write a small data area. Loading a node
+into a machine that holds a related node copies only the blocks in which
+the two differ.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "chip8_fork.h"
+
+// memory block b of a machine marked written
+static inline bool fork_written(const chip8_t *c, unsigned int b)
+{
+	return c->written[b >> 6] >> (b & 63) & 1;
+}
+
+// share a block
+static inline chip8_block_t *fork_share(chip8_block_t *b)
+{
+	atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+	return b;
+}
+
+// drop a reference to a block
+static void fork_drop(chip8_block_t *b)
+{
+	if(b && atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) == 1) free(b);
+}
+
+// the block of a node for data: its own block if the contents are the same,
+// otherwise a new one
+static chip8_block_t *fork_block(chip8_block_t *own, const unsigned char *data)
+{
+	if(own && !memcmp(own->data, data, CHIP8_FORK_BLOCK)) return fork_share(own);
+	chip8_block_t *b = malloc(sizeof(chip8_block_t));
+	if(b == NULL) return NULL;
+	atomic_init(&b->refs, 1);
+	memcpy(b->data, data, CHIP8_FORK_BLOCK);
+	return b;
+}
+
+// save a machine as a node
+chip8_node_t *chip8_fork(chip8_t *c, const chip8_node_t *base)
+{
+	unsigned int blocks = chip8_memsize(c->mode)/CHIP8_FORK_BLOCK;
+	chip8_node_t *n = calloc(1, sizeof(chip8_node_t) + blocks*sizeof(chip8_block_t*));
+	if(n == NULL) return NULL;
+	atomic_init(&n->refs, 1);
+
+	// registers and timers
+	n->pc = c->pc;
+	n->I = c->I;
+	n->sp = c->sp;
+	n->opcode = c->opcode;
+	memcpy(n->V, c->V, sizeof(n->V));
+	n->keyflag = c->keyflag;
+	n->mode = c->mode;
+	n->hires = c->hires;
+	n->planes = c->planes;
+	memcpy(n->stack, c->stack, sizeof(n->stack));
+	n->delay_end = c->delay_end;
+	n->sound_end = c->sound_end;
+	n->sound_cycle = c->sound_cycle;
+	n->tick_cycle = c->tick_cycle;
+	n->tick_base = c->tick_base;
+	n->rate = c->rate;
+	n->rng = c->rng;
+	n->cycles = c->cycles;
+	n->unknown = c->unknown;
+	memcpy(n->flags, c->flags, sizeof(n->flags));
+	memcpy(n->pattern, c->pattern, sizeof(n->pattern));
+	n->pitch = c->pitch;
+
+	// screen blocks that didn't change are shared
+	bool ok = true;
+	const unsigned char *screen = (const unsigned char*)c->screen;
+	for(int s = 0; s < CHIP8_FORK_SCREEN; s++)
+	{
+		n->screen[s] = fork_block(base ? base->screen[s] : NULL, screen + s*CHIP8_FORK_BLOCK);
+		ok &= n->screen[s] != NULL;
+	}
+
+	// memory blocks that weren't written are shared without looking, written
+	// ones if they hold the same bytes again
+	n->blocks = blocks;
+	if(base && base->mode != c->mode) base = NULL;
+	for(unsigned int b = 0; b < blocks; b++)
+	{
+		if(base && !fork_written(c, b)) n->memory[b] = fork_share(base->memory[b]);
+		else n->memory[b] = fork_block(base ? base->memory[b] : NULL, c->memory + b*CHIP8_FORK_BLOCK);
+		ok &= n->memory[b] != NULL;
+	}
+	if(!ok)
+	{
+		chip8_node_release(n);
+		return NULL;
+	}
+
+	memset(c->written, 0, sizeof(c->written));
+	return n;
+}
+
+// load a node into a machine
+void chip8_fork_load(chip8_t *c, const chip8_node_t *n, const chip8_node_t *from)
+{
+	// another variant decodes differently and has other memory
+	if(from && (from->mode != n->mode || c->mode != n->mode)) from = NULL;
+	if(from == NULL) chip8_setmode(c, n->mode);
+
+	c->pc = n->pc;
+	c->I = n->I;
+	c->sp = n->sp;
+	c->opcode = n->opcode;
+	memcpy(c->V, n->V, sizeof(c->V));
+	c->keyflag = n->keyflag;
+	c->hires = n->hires;
+	c->planes = n->planes;
+	memcpy(c->stack, n->stack, sizeof(c->stack));
+	c->delay_end = n->delay_end;
+	c->sound_end = n->sound_end;
+	c->sound_cycle = n->sound_cycle;
+	c->tick_cycle = n->tick_cycle;
+	c->tick_base = n->tick_base;
+	c->rate = n->rate;
+	c->rng = n->rng;
+	c->cycles = n->cycles;
+	c->unknown = n->unknown;
+	memcpy(c->flags, n->flags, sizeof(c->flags));
+	memcpy(c->pattern, n->pattern, sizeof(c->pattern));
+	c->pitch = n->pitch;
+
+	// the screen isn't tracked, it is small enough to copy whole
+	unsigned char *screen = (unsigned char*)c->screen;
+	for(int s = 0; s < CHIP8_FORK_SCREEN; s++) memcpy(screen + s*CHIP8_FORK_BLOCK, n->screen[s]->data, CHIP8_FORK_BLOCK);
+
+	// memory blocks that differ, with the predecoded instructions they hold
+	for(unsigned int b = 0; b < n->blocks; b++)
+	{
+		if(from && n->memory[b] == from->memory[b] && !fork_written(c, b)) continue;
+		memcpy(c->memory + b*CHIP8_FORK_BLOCK, n->memory[b]->data, CHIP8_FORK_BLOCK);
+		memset(&c->decoded[(b*CHIP8_FORK_BLOCK & 0xFFF) >> 1], 0, CHIP8_FORK_BLOCK/2*sizeof(chip8_op_t));
+	}
+	memset(c->written, 0, sizeof(c->written));
+}
+
+// take another reference to a node
+chip8_node_t *chip8_node_ref(chip8_node_t *n)
+{
+	atomic_fetch_add_explicit(&n->refs, 1, memory_order_relaxed);
+	return n;
+}
+
+// drop a reference to a node
+void chip8_node_release(chip8_node_t *n)
+{
+	if(atomic_fetch_sub_explicit(&n->refs, 1, memory_order_acq_rel) != 1) return;
+	for(int s = 0; s < CHIP8_FORK_SCREEN; s++) fork_drop(n->screen[s]);
+	for(unsigned int b = 0; b < n->blocks; b++) fork_drop(n->memory[b]);
+	free(n);
+}
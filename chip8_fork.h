@@ -0,0 +1,76 @@
+/******************************************************************************
+chip8_fork.h
+CHIP-8 state trees: machine states that share their memory and screen
+copy-on-write, for searches that branch from a state many times.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// bytes per shared block
+#define CHIP8_FORK_BLOCK 256
+
+// screen blocks of a node
+#define CHIP8_FORK_SCREEN (2*64*2*8/CHIP8_FORK_BLOCK)
+
+// block of memory or screen, read-only once it is in a node
+typedef struct chip8_block_t
+{
+	_Atomic unsigned int refs; // nodes holding it
+	unsigned char data[CHIP8_FORK_BLOCK]; // contents
+} chip8_block_t;
+
+// saved machine state, read-only and shared by reference counting, so any
+// number of threads can read and load it. registers and timers are kept by
+// value, screen and memory as blocks shared with the node it was forked from.
+typedef struct chip8_node_t
+{
+	_Atomic unsigned int refs; // holders of the node
+
+	// cpu state, as in chip8_state_t
+	unsigned short pc; // program counter
+	unsigned short I; // index register
+	unsigned short sp; // stack pointer
+	unsigned short opcode; // current opcode
+	unsigned char V[16]; // data register
+	unsigned char keyflag; // flag for input update used in FX0A
+	unsigned char mode; // machine variant
+	bool hires; // 128x64 screen
+	unsigned char planes; // bitplanes drawn to
+	unsigned short stack[16]; // stack
+	unsigned long long delay_end; // tick at which the delay timer reaches 0
+	unsigned long long sound_end; // tick at which the sound timer reaches 0
+	unsigned long long sound_cycle; // cycle at which FX18 last started the sound
+	unsigned long long tick_cycle; // cycle count from which ticks are counted
+	unsigned long long tick_base; // ticks before tick_cycle
+	unsigned int rate; // instructions per second
+	unsigned long long rng; // CXNN random number generator state
+	unsigned long long cycles; // executed instructions
+	unsigned long unknown; // unknown opcodes encountered
+	unsigned char flags[16]; // RPL user flags
+	unsigned char pattern[16]; // audio pattern
+	unsigned char pitch; // audio pitch
+
+	// screen and memory
+	chip8_block_t *screen[CHIP8_FORK_SCREEN]; // bitplanes in chip8_t order
+	unsigned int blocks; // memory blocks, chip8_memsize(mode)/CHIP8_FORK_BLOCK
+	chip8_block_t *memory[]; // memory
+} chip8_node_t;
+
+// save a machine as a node, which holds one reference. the machine must hold
+// base apart from the memory blocks marked written in it: it was loaded from
+// base or forked as base and ran since. blocks that are still the same as in
+// base are shared with it, base NULL copies everything. clears the written
+// marks, so the machine holds the new node. returns NULL if out of memory.
+chip8_node_t *chip8_fork(chip8_t *c, const chip8_node_t *base);
+
+// load a node into a machine that holds from (as chip8_fork describes) or
+// anything if from is NULL. only the memory blocks that differ between the
+// two nodes or were written are copied. keys and host settings stay, a
+// compiler for this machine must be flushed.
+void chip8_fork_load(chip8_t *c, const chip8_node_t *n, const chip8_node_t *from);
+
+// take another reference to a node
+chip8_node_t *chip8_node_ref(chip8_node_t *n);
+
+// drop a reference, the last one frees the node and the blocks no other node holds
+void chip8_node_release(chip8_node_t *n);
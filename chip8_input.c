@@ -0,0 +1,289 @@
+/******************************************************************************
+chip8_input.c
+CHIP-8 input recording: a session as seed, settings and timed key changes.
+
+The machine is deterministic given its rom, seed, rate and quirks, so a
+session is fully described by when the keys changed. Events are timestamped
+with the instruction count instead of host time and the keys are only stored
+when they change, a run of frames with the same keys costs nothing. Every
+second a hash of the screen is stored as a checkpoint, a replay that drifts
+off is caught close to where it happened.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "chip8_rom.h"
+#include "chip8_input.h"
+
+// add an event, returns false if out of memory
+static bool input_add(chip8_input_t *in, unsigned long long cycle, unsigned char type, unsigned long long value)
+{
+	if(in->count == in->size)
+	{
+		unsigned int size = in->size ? in->size*2 : 1024;
+		chip8_event_t *events = realloc(in->events, size*sizeof(chip8_event_t));
+		if(events == NULL) return false;
+		in->events = events;
+		in->size = size;
+	}
+	chip8_event_t *e = &in->events[in->count++];
+	e->cycle = cycle;
+	e->type = type;
+	e->value = value;
+	return true;
+}
+
+// key state of a machine as a bit mask
+static unsigned short input_mask(const chip8_t *c)
+{
+	unsigned short mask = 0;
+	for(int k = 0; k < 16; k++) if(c->key[k]) mask |= 1 << k;
+	return mask;
+}
+
+// start a recording of a machine that was just seeded and reset with rom
+chip8_input_t *chip8_input_create(const chip8_t *c, const chip8_rom_t *rom, unsigned long long seed, unsigned char quirks)
+{
+	chip8_input_t *in = calloc(1, sizeof(chip8_input_t));
+	if(in == NULL) return NULL;
+	memcpy(in->header.magic, "J8IN", 4);
+	in->header.mode = rom->mode;
+	in->header.quirks = quirks;
+	in->header.rate = c->rate;
+	in->header.seed = seed;
+	in->header.hash = rom->hash;
+	in->header.len = rom->len;
+	return in;
+}
+
+// release a recording
+void chip8_input_destroy(chip8_input_t *in)
+{
+	free(in->events);
+	free(in);
+}
+
+// record the machine's keys if they changed
+void chip8_input_keys(chip8_input_t *in, const chip8_t *c)
+{
+	unsigned short mask = input_mask(c);
+	if(mask == in->keys) return;
+	in->keys = mask;
+
+	// several changes without an instruction in between only need the last
+	chip8_event_t *last = in->count ? &in->events[in->count - 1] : NULL;
+	if(last && last->type == CHIP8_INPUT_KEYS && last->cycle == c->cycles) last->value = mask;
+	else input_add(in, c->cycles, CHIP8_INPUT_KEYS, mask);
+}
+
+// record a checkpoint of the machine's screen
+void chip8_input_check(chip8_input_t *in, const chip8_t *c)
+{
+	input_add(in, c->cycles, CHIP8_INPUT_CHECK, chip8_screenhash(c));
+}
+
+// record changed quirk flags
+void chip8_input_quirks(chip8_input_t *in, const chip8_t *c, unsigned char quirks)
+{
+	input_add(in, c->cycles, CHIP8_INPUT_QUIRKS, quirks);
+}
+
+// record a reset of the machine
+void chip8_input_reset(chip8_input_t *in)
+{
+	input_add(in, 0, CHIP8_INPUT_RESET, 0);
+}
+
+// forget the events after the machine's cycle count, after it was rewound.
+// the rewound state holds the random generator, so the session from there on
+// is as if the dropped part never happened. rewinding never crosses a reset.
+void chip8_input_rewind(chip8_input_t *in, const chip8_t *c)
+{
+	int quirks = -1; // newest dropped quirk flags, they still apply
+	while(in->count && in->events[in->count - 1].type != CHIP8_INPUT_RESET && in->events[in->count - 1].cycle > c->cycles)
+	{
+		in->count--;
+		if(quirks < 0 && in->events[in->count].type == CHIP8_INPUT_QUIRKS) quirks = in->events[in->count].value;
+	}
+	if(quirks >= 0) input_add(in, c->cycles, CHIP8_INPUT_QUIRKS, quirks);
+
+	// a replay holds the keys of the last remaining key event, the machine
+	// holds the keys still pressed, which may have been pressed in the dropped part
+	in->keys = 0;
+	for(unsigned int i = in->count; i-- > 0; )
+	{
+		if(in->events[i].type != CHIP8_INPUT_KEYS) continue;
+		in->keys = in->events[i].value;
+		break;
+	}
+	chip8_input_keys(in, c);
+}
+
+// write an unsigned varint, 7 bits per byte, lowest first
+static void input_putvar(FILE *fp, unsigned long long v)
+{
+	while(v >= 0x80)
+	{
+		fputc((v & 0x7F) | 0x80, fp);
+		v >>= 7;
+	}
+	fputc(v, fp);
+}
+
+// write a little endian value of n bytes
+static void input_put(FILE *fp, unsigned long long v, int n)
+{
+	for(int i = 0; i < n; i++) fputc(v >> 8*i, fp);
+}
+
+// payload size of an event type
+static const int input_payload[4] = {2, 8, 1, 0};
+
+// write one event relative to the cycle of the previous one, a reset starts over at 0
+static void input_write(FILE *fp, const chip8_event_t *e, unsigned long long *base)
+{
+	input_putvar(fp, (e->type == CHIP8_INPUT_RESET ? 0 : e->cycle - *base) << 2 | e->type);
+	input_put(fp, e->value, input_payload[e->type]);
+	*base = e->cycle;
+}
+
+// write the recording with a final checkpoint of the machine, returns 1 on error
+bool chip8_input_save(const chip8_input_t *in, const chip8_t *c, const char *file)
+{
+	FILE *fp = fopen(file, "wb");
+	if(fp == NULL) return 1;
+	chip8_inputfile_t h = in->header;
+	h.count = in->count + 1;
+	fwrite(&h, sizeof(h), 1, fp);
+	unsigned long long base = 0;
+	for(unsigned int i = 0; i < in->count; i++) input_write(fp, &in->events[i], &base);
+	chip8_event_t end = {c->cycles, chip8_screenhash(c), CHIP8_INPUT_CHECK};
+	input_write(fp, &end, &base);
+	bool error = ferror(fp);
+	if(fclose(fp)) error = true;
+	if(!c->quiet && !error) printf("Recording of %llu instructions written to %s\n", c->cycles, file);
+	return error;
+}
+
+// read an unsigned varint, returns false at the end of the file
+static bool input_getvar(FILE *fp, unsigned long long *v)
+{
+	*v = 0;
+	for(int shift = 0; shift < 64; shift += 7)
+	{
+		int b = fgetc(fp);
+		if(b == EOF) return false;
+		*v |= (unsigned long long)(b & 0x7F) << shift;
+		if(!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+// read a recording, returns NULL if it can't be read
+chip8_input_t *chip8_input_load(const char *file)
+{
+	FILE *fp = fopen(file, "rb");
+	if(fp == NULL) return NULL;
+	chip8_input_t *in = calloc(1, sizeof(chip8_input_t));
+	if(in == NULL || fread(&in->header, sizeof(in->header), 1, fp) != 1 || memcmp(in->header.magic, "J8IN", 4)) goto fail;
+
+	// events, cycles are relative to the previous event and start over at a reset
+	unsigned long long base = 0;
+	for(unsigned int i = 0; i < in->header.count; i++)
+	{
+		unsigned long long v, value = 0;
+		if(!input_getvar(fp, &v)) goto fail;
+		unsigned char type = v & 3;
+		for(int b = 0; b < input_payload[type]; b++)
+		{
+			int byte = fgetc(fp);
+			if(byte == EOF) goto fail;
+			value |= (unsigned long long)byte << 8*b;
+		}
+		base = type == CHIP8_INPUT_RESET ? 0 : base + (v >> 2);
+		if(!input_add(in, base, type, value)) goto fail;
+	}
+	fclose(fp);
+	return in;
+
+fail:
+	fclose(fp);
+	if(in) chip8_input_destroy(in);
+	return NULL;
+}
+
+// run a machine up to an instruction count. with a tick callback it runs a
+// tick at a time and calls it at the end of every tick that changed the
+// screen, drawn carries a change over to the end of the tick.
+static void input_runto(chip8_t *c, unsigned long long cycle, unsigned char quirks, chip8_tick_t tick, void *data, bool *drawn)
+{
+	while(c->cycles < cycle)
+	{
+		// ticks end at the same instructions as in the window
+		unsigned long long end = cycle, t = c->cycles*60/c->rate;
+		while(t*c->rate/60 <= c->cycles) t++;
+		if(tick && t*c->rate/60 < end) end = t*c->rate/60;
+		unsigned int n = end - c->cycles > (1 << 24) ? 1 << 24 : end - c->cycles;
+		*drawn |= chip8_run(c, n, quirks & CHIP8_INPUT_WRAP, quirks & CHIP8_INPUT_COWGOD);
+		if(tick && *drawn && c->cycles == t*c->rate/60)
+		{
+			tick(data, c);
+			*drawn = false;
+		}
+	}
+}
+
+// replay a recording at full speed on a machine, rom must match the header.
+// returns the number of checkpoints whose screen differs, checked counts them all
+// and first is the instruction count of the first that differs, tick is
+// called after every tick that changed the screen.
+unsigned int chip8_input_replay(const chip8_input_t *in, chip8_t *c, const chip8_rom_t *rom, unsigned int *checked, unsigned long long *first, chip8_tick_t tick, void *data)
+{
+	// same start as the recorded session
+	unsigned char quirks = in->header.quirks;
+	chip8_seed(c, in->header.seed);
+	chip8_reset(c, rom);
+	chip8_setrate(c, in->header.rate);
+	memset(c->key, 0, sizeof(c->key));
+
+	// apply every event once the machine reaches its cycle
+	bool drawn = true;
+	unsigned int failed = 0;
+	*checked = 0;
+	*first = 0;
+	for(unsigned int i = 0; i < in->count; i++)
+	{
+		const chip8_event_t *e = &in->events[i];
+		input_runto(c, e->cycle, quirks, tick, data, &drawn);
+		switch(e->type)
+		{
+			case CHIP8_INPUT_KEYS:
+				for(int k = 0; k < 16; k++) c->key[k] = e->value >> k & 1;
+				break;
+
+			case CHIP8_INPUT_CHECK:
+				(*checked)++;
+				if(chip8_screenhash(c) == e->value) break;
+				if(!failed++) *first = e->cycle;
+				break;
+
+			case CHIP8_INPUT_QUIRKS:
+				quirks = e->value;
+				break;
+
+			case CHIP8_INPUT_RESET:
+				chip8_reset(c, rom);
+				chip8_setrate(c, in->header.rate);
+				drawn = true;
+				break;
+		}
+	}
+	if(tick && drawn) tick(data, c);
+	return failed;
+}
@@ -0,0 +1,93 @@
+/******************************************************************************
+chip8_input.h
+CHIP-8 input recording: a session as seed, settings and timed key changes.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// default recording file
+#define CHIP8_INPUT_FILE "Jos8-input.bin"
+
+// quirk flags of a recording
+#define CHIP8_INPUT_WRAP 1 // screen wrapping
+#define CHIP8_INPUT_COWGOD 2 // Cowgod-syntax
+
+// event types
+enum
+{
+	CHIP8_INPUT_KEYS, // new key state, value = bit mask of pressed keys
+	CHIP8_INPUT_CHECK, // checkpoint, value = screen hash
+	CHIP8_INPUT_QUIRKS, // quirk flags changed, value = CHIP8_INPUT_ flags
+	CHIP8_INPUT_RESET // machine reset, cycles start over from 0
+};
+
+// one event, at the instruction count it happened at
+typedef struct chip8_event_t
+{
+	unsigned long long cycle; // instructions executed since the last reset
+	unsigned long long value; // event data
+	unsigned char type; // CHIP8_INPUT_ type
+} chip8_event_t;
+
+// recording file header, followed by the events. each event is a varint of
+// its cycle distance to the previous event (or reset) shifted left by 2 with
+// the type in the low bits, then 2 bytes of keys, 8 bytes of hash or 1 byte
+// of quirks, all little endian. keys are only stored when they change.
+typedef struct chip8_inputfile_t
+{
+	char magic[4]; // "J8IN"
+	unsigned char mode; // machine variant
+	unsigned char quirks; // CHIP8_INPUT_ flags at the start
+	unsigned short reserved;
+	unsigned int rate; // instructions per second
+	unsigned int count; // number of events
+	unsigned long long seed; // CXNN random seed
+	unsigned long long hash; // FNV-1a hash of the rom
+	unsigned long long len; // rom size
+} chip8_inputfile_t;
+
+// a recording in memory
+typedef struct chip8_input_t
+{
+	chip8_inputfile_t header; // session settings
+	chip8_event_t *events; // events in order
+	unsigned int count, size; // number of events and allocated size
+	unsigned short keys; // key state of the last key event
+} chip8_input_t;
+
+// start a recording of a machine that was just seeded and reset with rom
+chip8_input_t *chip8_input_create(const chip8_t *c, const chip8_rom_t *rom, unsigned long long seed, unsigned char quirks);
+
+// release a recording
+void chip8_input_destroy(chip8_input_t *in);
+
+// record the machine's keys if they changed
+void chip8_input_keys(chip8_input_t *in, const chip8_t *c);
+
+// record a checkpoint of the machine's screen
+void chip8_input_check(chip8_input_t *in, const chip8_t *c);
+
+// record changed quirk flags
+void chip8_input_quirks(chip8_input_t *in, const chip8_t *c, unsigned char quirks);
+
+// record a reset of the machine
+void chip8_input_reset(chip8_input_t *in);
+
+// forget the events after the machine's cycle count, after it was rewound,
+// and record the keys the machine holds now
+void chip8_input_rewind(chip8_input_t *in, const chip8_t *c);
+
+// write the recording with a final checkpoint of the machine, returns 1 on error
+bool chip8_input_save(const chip8_input_t *in, const chip8_t *c, const char *file);
+
+// read a recording, returns NULL if it can't be read
+chip8_input_t *chip8_input_load(const char *file);
+
+// called with the machine after every 60Hz tick of a replay that changed the screen
+typedef void (*chip8_tick_t)(void *data, const chip8_t *c);
+
+// replay a recording at full speed on a machine, rom must match the header.
+// returns the number of checkpoints whose screen differs, checked counts them all
+// and first is the instruction count of the first that differs. tick, if not
+// NULL, is called with data after every tick that changed the screen.
+unsigned int chip8_input_replay(const chip8_input_t *in, chip8_t *c, const chip8_rom_t *rom, unsigned int *checked, unsigned long long *first, chip8_tick_t tick, void *data);
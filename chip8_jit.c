@@ -0,0 +1,783 @@
+/******************************************************************************
+chip8_jit.c
+CHIP-8 basic block compiler for x86-64.
+
+Straight-line runs of simple instructions are translated to native code,
+ending at a jump, call, return or skip. V registers used by a block live in
+host registers while it runs. A finished block jumps straight into the block
+at the new pc through a table of entry points, so loops stay in native code
+until the cycle budget runs out. DXYN, CXNN, FX0A, the timer opcodes (which
+need the cycle count) and everything that writes memory are left to the
+predecoded interpreter, so results are identical to chip8_cycle. The
+interpreter then runs on in one call up to the next address with compiled
+code, told by an address map (chip8_run_until), rather than returning for
+every instruction. Blocks are compiled for one setting of Cowgod-syntax and
+dropped when it changes. SCHIP and XO-CHIP machines and other platforms just
+run the interpreter.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "chip8.h"
+#include "chip8_jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+// settings
+#define JIT_CODE_SIZE (1 << 20) // executable memory per machine
+#define JIT_BLOCK_MAX 32 // max instructions per block
+#define JIT_BLOCK_BYTES 2048 // max native code per block
+
+// native block: takes the cycle budget in esi and returns what is left of it
+typedef unsigned int (*jit_code_t)(chip8_t *c, unsigned int n);
+
+// compiled block, one per start address
+typedef struct jit_block_t
+{
+	unsigned short len; // instructions, 0 = interpret
+	unsigned short size; // bytes of memory the block was compiled from
+	bool compiled; // entry is valid
+} jit_block_t;
+
+// compiler state for one machine
+struct chip8_jit_t
+{
+	chip8_t *c; // machine
+	unsigned char *code; // executable memory
+	size_t used; // bytes of code in use
+	void *entry[4096]; // native entry by address, the exit stub if not compiled
+	jit_block_t blocks[4096]; // blocks by start address
+	unsigned char cover[4096]; // number of blocks compiled from each byte
+	unsigned char until[4096]; // CHIP8_UNTIL_ flags of each address for the interpreter
+	bool cowgod; // Cowgod-syntax the blocks were compiled for
+};
+
+// emitter state for the block being compiled
+typedef struct jit_emit_t
+{
+	unsigned char *p; // write position
+	signed char host[16]; // host register holding each V register, -1 = none
+	bool dirty[16]; // V register changed by the block
+	int nhost; // host registers in use
+	bool cowgod; // Cowgod-syntax 8XY6/8XYE
+} jit_emit_t;
+
+// host registers for V, caller-saved ones first. rdi holds the machine,
+// esi the cycle budget, eax and ecx are scratch.
+static const unsigned char jit_regs[] = {2, 8, 9, 10, 11, 3, 5, 12, 13, 14, 15};
+#define JIT_REGS ((int)sizeof(jit_regs))
+
+// x86 registers and condition codes used below
+enum { RAX = 0, RCX = 1, RBX = 3, RBP = 5, RSI = 6, RDI = 7 };
+enum { CC_E = 0x4, CC_NE = 0x5, CC_AE = 0x3, CC_BE = 0x6 };
+
+// x86 arithmetic groups, the /digit of the 0x81 form, op << 3 | 1 is the r/m, reg form
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+
+// context field offsets
+#define OFF_PC offsetof(chip8_t, pc)
+#define OFF_I offsetof(chip8_t, I)
+#define OFF_SP offsetof(chip8_t, sp)
+#define OFF_V offsetof(chip8_t, V)
+#define OFF_KEY offsetof(chip8_t, key)
+#define OFF_STACK offsetof(chip8_t, stack)
+#define OFF_OPCODE offsetof(chip8_t, opcode)
+
+// exit stub at the start of the code buffer: return the budget in esi
+static const unsigned char jit_stub[] = {0x89, 0xF0, 0xC3}; // mov eax, esi; ret
+
+// raw bytes
+static void emit8(jit_emit_t *e, unsigned char b)
+{
+	*e->p++ = b;
+}
+
+static void emit16(jit_emit_t *e, unsigned short w)
+{
+	memcpy(e->p, &w, 2);
+	e->p += 2;
+}
+
+static void emit32(jit_emit_t *e, unsigned int d)
+{
+	memcpy(e->p, &d, 4);
+	e->p += 4;
+}
+
+// REX prefix if any extended register is used
+static void emit_rex(jit_emit_t *e, int reg, int rm)
+{
+	if(reg >= 8 || rm >= 8) emit8(e, 0x40 | (reg >= 8) << 2 | (rm >= 8));
+}
+
+// op r32, r32 in r/m, reg form: dst = dst op src
+static void emit_rr(jit_emit_t *e, unsigned char op, int dst, int src)
+{
+	emit_rex(e, src, dst);
+	emit8(e, op);
+	emit8(e, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+// mov dst, src
+static void emit_mov(jit_emit_t *e, int dst, int src)
+{
+	if(dst != src) emit_rr(e, 0x89, dst, src);
+}
+
+// alu dst, src
+static void emit_alu(jit_emit_t *e, int alu, int dst, int src)
+{
+	emit_rr(e, alu << 3 | 1, dst, src);
+}
+
+// alu dst, imm32
+static void emit_alu_imm(jit_emit_t *e, int alu, int dst, unsigned int imm)
+{
+	emit_rex(e, 0, dst);
+	emit8(e, 0x81);
+	emit8(e, 0xC0 | alu << 3 | (dst & 7));
+	emit32(e, imm);
+}
+
+// mov dst, imm32
+static void emit_mov_imm(jit_emit_t *e, int dst, unsigned int imm)
+{
+	emit_rex(e, 0, dst);
+	emit8(e, 0xB8 | (dst & 7));
+	emit32(e, imm);
+}
+
+// movzx dst, byte [rdi+disp]
+static void emit_load8(jit_emit_t *e, int dst, unsigned int disp)
+{
+	emit_rex(e, dst, 0);
+	emit8(e, 0x0F);
+	emit8(e, 0xB6);
+	emit8(e, 0x80 | (dst & 7) << 3 | RDI);
+	emit32(e, disp);
+}
+
+// mov byte [rdi+disp], src (through al)
+static void emit_store8(jit_emit_t *e, unsigned int disp, int src)
+{
+	emit_mov(e, RAX, src);
+	emit8(e, 0x88);
+	emit8(e, 0x80 | RAX << 3 | RDI);
+	emit32(e, disp);
+}
+
+// mov word [rdi+disp], imm16
+static void emit_store16_imm(jit_emit_t *e, unsigned int disp, unsigned short imm)
+{
+	emit8(e, 0x66);
+	emit8(e, 0xC7);
+	emit8(e, 0x80 | RDI);
+	emit32(e, disp);
+	emit16(e, imm);
+}
+
+// mov word [rdi+disp], src16
+static void emit_store16(jit_emit_t *e, unsigned int disp, int src)
+{
+	emit8(e, 0x66);
+	emit_rex(e, src, 0);
+	emit8(e, 0x89);
+	emit8(e, 0x80 | (src & 7) << 3 | RDI);
+	emit32(e, disp);
+}
+
+// movzx eax, word [rdi+disp]
+static void emit_load16_eax(jit_emit_t *e, unsigned int disp)
+{
+	emit8(e, 0x0F);
+	emit8(e, 0xB7);
+	emit8(e, 0x80 | RAX << 3 | RDI);
+	emit32(e, disp);
+}
+
+// and eax, 0xF, used to wrap stack and key indices
+static void emit_mask_eax(jit_emit_t *e)
+{
+	emit8(e, 0x83);
+	emit8(e, 0xE0);
+	emit8(e, 0x0F);
+}
+
+// shl or shr dst, imm8
+static void emit_shift(jit_emit_t *e, int dst, bool left, unsigned char imm)
+{
+	emit_rex(e, 0, dst);
+	emit8(e, 0xC1);
+	emit8(e, 0xC0 | (left ? 4 : 5) << 3 | (dst & 7));
+	emit8(e, imm);
+}
+
+// mov word [pc], cond ? taken : not_taken, flags must be set by the caller
+static void emit_select_pc(jit_emit_t *e, int cc, unsigned short taken, unsigned short not_taken)
+{
+	emit_mov_imm(e, RCX, not_taken);
+	emit_mov_imm(e, RAX, taken);
+	emit8(e, 0x0F);
+	emit8(e, 0x40 | cc);
+	emit8(e, 0xC0 | RCX << 3 | RAX); // cmovcc ecx, eax
+	emit_store16(e, OFF_PC, RCX);
+}
+
+// host register of a V register
+static int jit_reg(jit_emit_t *e, int v)
+{
+	return e->host[v];
+}
+
+// mark a V register as changed and keep it a byte
+static void jit_written(jit_emit_t *e, int v, bool mask)
+{
+	if(mask) emit_alu_imm(e, ALU_AND, jit_reg(e, v), 0xFF);
+	e->dirty[v] = true;
+}
+
+// kinds of instructions as seen by the compiler
+enum { JIT_INTERPRET, JIT_STRAIGHT, JIT_END };
+
+// classify an opcode and list the V registers it uses
+static int jit_classify(unsigned short opcode, bool cowgod, unsigned short *uses)
+{
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	*uses = 0;
+	switch(opcode & 0xF000)
+	{
+		case 0x0000:
+			if((opcode & 0x000F) == 0x000E) return JIT_END; // 00EE
+			return JIT_INTERPRET;
+		case 0x1000:
+		case 0x2000:
+			return JIT_END;
+		case 0x3000:
+		case 0x4000:
+			*uses = 1 << x;
+			return JIT_END;
+		case 0x5000:
+		case 0x9000:
+			*uses = 1 << x | 1 << y;
+			return JIT_END;
+		case 0x6000:
+		case 0x7000:
+			*uses = 1 << x;
+			return JIT_STRAIGHT;
+		case 0x8000:
+			switch(opcode & 0x000F)
+			{
+				case 0x0000: case 0x0001: case 0x0002: case 0x0003:
+					*uses = 1 << x | 1 << y;
+					return JIT_STRAIGHT;
+				case 0x0004: case 0x0005: case 0x0007:
+					*uses = 1 << x | 1 << y | 1 << 0xF;
+					return JIT_STRAIGHT;
+				case 0x0006: case 0x000E:
+					*uses = 1 << x | (cowgod ? 0 : 1 << y) | 1 << 0xF;
+					return JIT_STRAIGHT;
+			}
+			return JIT_INTERPRET;
+		case 0xA000:
+			return JIT_STRAIGHT;
+		case 0xB000:
+			*uses = 1;
+			return JIT_END;
+		case 0xE000:
+			if((opcode & 0x000F) != 0x000E && (opcode & 0x000F) != 0x0001) return JIT_INTERPRET;
+			*uses = 1 << x;
+			return JIT_END;
+		case 0xF000:
+			switch(opcode & 0x00FF)
+			{
+				case 0x001E: case 0x0029:
+					*uses = 1 << x;
+					return JIT_STRAIGHT;
+			}
+			return JIT_INTERPRET; // timers are read from the cycle counter
+	}
+	return JIT_INTERPRET; // CXNN, DXYN
+}
+
+// push or pop a 64-bit register
+static void emit_push(jit_emit_t *e, int r, bool pop)
+{
+	emit_rex(e, 0, r);
+	emit8(e, (pop ? 0x58 : 0x50) | (r & 7));
+}
+
+// inc or dec word [rdi+disp]
+static void emit_incdec16(jit_emit_t *e, unsigned int disp, bool dec)
+{
+	emit8(e, 0x66);
+	emit8(e, 0xFF);
+	emit8(e, 0x80 | dec << 3 | RDI);
+	emit32(e, disp);
+}
+
+// eax = stack slot address index, sp & 0xF
+static void emit_stack_index(jit_emit_t *e)
+{
+	emit_load16_eax(e, OFF_SP);
+	emit_mask_eax(e);
+}
+
+// translate one instruction at address pc
+static void jit_emit_op(jit_emit_t *e, unsigned short opcode, unsigned short pc)
+{
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	unsigned char nn = opcode & 0x00FF;
+	unsigned short nnn = opcode & 0x0FFF;
+	int rx = jit_reg(e, x);
+	int ry = jit_reg(e, y);
+	int rf = jit_reg(e, 0xF);
+	
+	switch(opcode & 0xF000)
+	{
+		// 00EE return
+		case 0x0000:
+			emit_incdec16(e, OFF_SP, true);
+			emit_stack_index(e);
+			emit8(e, 0x0F); // movzx eax, word [rdi+rax*2+stack]
+			emit8(e, 0xB7);
+			emit8(e, 0x84);
+			emit8(e, 0x47);
+			emit32(e, OFF_STACK);
+			emit_store16(e, OFF_PC, RAX);
+			break;
+		
+		// 1NNN goto NNN
+		case 0x1000:
+			emit_store16_imm(e, OFF_PC, nnn);
+			break;
+		
+		// 2NNN call subroutine NNN
+		case 0x2000:
+			emit_stack_index(e);
+			emit8(e, 0x66); // mov word [rdi+rax*2+stack], pc+2
+			emit8(e, 0xC7);
+			emit8(e, 0x84);
+			emit8(e, 0x47);
+			emit32(e, OFF_STACK);
+			emit16(e, pc + 2);
+			emit_incdec16(e, OFF_SP, false);
+			emit_store16_imm(e, OFF_PC, nnn);
+			break;
+		
+		// 3XNN/4XNN skip if(Vx==NN)/if(Vx!=NN)
+		case 0x3000:
+		case 0x4000:
+			emit_alu_imm(e, ALU_CMP, rx, nn);
+			emit_select_pc(e, (opcode & 0xF000) == 0x3000 ? CC_E : CC_NE, pc + 4, pc + 2);
+			break;
+		
+		// 5XY0/9XY0 skip if(Vx==Vy)/if(Vx!=Vy)
+		case 0x5000:
+		case 0x9000:
+			emit_alu(e, ALU_CMP, rx, ry);
+			emit_select_pc(e, (opcode & 0xF000) == 0x5000 ? CC_E : CC_NE, pc + 4, pc + 2);
+			break;
+		
+		// 6XNN Vx = NN
+		case 0x6000:
+			emit_mov_imm(e, rx, nn);
+			jit_written(e, x, false);
+			break;
+		
+		// 7XNN Vx += NN
+		case 0x7000:
+			emit_alu_imm(e, ALU_ADD, rx, nn);
+			jit_written(e, x, true);
+			break;
+		
+		case 0x8000:
+			switch(opcode & 0x000F)
+			{
+				// 8XY0 Vx=Vy
+				case 0x0000:
+					emit_mov(e, rx, ry);
+					jit_written(e, x, false);
+					break;
+				
+				// 8XY1/8XY2/8XY3 Vx=Vx|Vy, Vx=Vx&Vy, Vx=Vx^Vy
+				case 0x0001:
+				case 0x0002:
+				case 0x0003:
+				{
+					static const int alu[4] = {0, ALU_OR, ALU_AND, ALU_XOR};
+					emit_alu(e, alu[opcode & 0x000F], rx, ry);
+					jit_written(e, x, false);
+					break;
+				}
+				
+				// 8XY4 Vx += Vy, VF = carry (VF is set before the add, like chip8_cycle)
+				case 0x0004:
+					emit_mov(e, RAX, rx);
+					emit_alu(e, ALU_ADD, RAX, ry);
+					emit8(e, 0xC1); // shr eax, 8
+					emit8(e, 0xE8);
+					emit8(e, 8);
+					emit_mov(e, rf, RAX);
+					jit_written(e, 0xF, false);
+					emit_alu(e, ALU_ADD, rx, ry);
+					jit_written(e, x, true);
+					break;
+				
+				// 8XY5 Vx -= Vy, VF = not borrow
+				case 0x0005:
+					emit8(e, 0x31); // xor eax, eax
+					emit8(e, 0xC0);
+					emit_alu(e, ALU_CMP, rx, ry);
+					emit8(e, 0x0F); // setae al
+					emit8(e, 0x90 | CC_AE);
+					emit8(e, 0xC0);
+					emit_mov(e, rf, RAX);
+					jit_written(e, 0xF, false);
+					emit_alu(e, ALU_SUB, rx, ry);
+					jit_written(e, x, true);
+					break;
+				
+				// 8XY6/8XYE Vx=Vx>>1, Vx=Vx<<1 with Cowgod-syntax, otherwise
+				// Vx=Vy=Vy>>1, Vx=Vy=Vy<<1. VF = shifted out bit, set first.
+				case 0x0006:
+				case 0x000E:
+				{
+					bool left = (opcode & 0x000F) == 0x000E;
+					int v = e->cowgod ? x : y, rv = jit_reg(e, v);
+					emit_mov(e, RAX, rv);
+					if(left) emit_shift(e, RAX, false, 7);
+					else emit_alu_imm(e, ALU_AND, RAX, 1);
+					emit_mov(e, rf, RAX);
+					jit_written(e, 0xF, false);
+					emit_shift(e, rv, left, 1);
+					jit_written(e, v, left);
+					if(!e->cowgod)
+					{
+						emit_mov(e, rx, rv);
+						jit_written(e, x, false);
+					}
+					break;
+				}
+				
+				// 8XY7 Vx=Vy-Vx, VF = not borrow
+				case 0x0007:
+					emit8(e, 0x31); // xor eax, eax
+					emit8(e, 0xC0);
+					emit_alu(e, ALU_CMP, rx, ry);
+					emit8(e, 0x0F); // setbe al
+					emit8(e, 0x90 | CC_BE);
+					emit8(e, 0xC0);
+					emit_mov(e, rf, RAX);
+					jit_written(e, 0xF, false);
+					emit_mov(e, RAX, ry);
+					emit_alu(e, ALU_SUB, RAX, rx);
+					emit_mov(e, rx, RAX);
+					jit_written(e, x, true);
+					break;
+			}
+			break;
+		
+		// ANNN I = NNN
+		case 0xA000:
+			emit_store16_imm(e, OFF_I, nnn);
+			break;
+		
+		// BNNN PC=V0+NNN
+		case 0xB000:
+			emit_mov(e, RAX, jit_reg(e, 0));
+			emit_alu_imm(e, ALU_ADD, RAX, nnn);
+			emit_store16(e, OFF_PC, RAX);
+			break;
+		
+		// EX9E/EXA1 skip if(key()==Vx)/if(key()!=Vx)
+		case 0xE000:
+			emit_mov(e, RAX, rx);
+			emit_mask_eax(e);
+			emit8(e, 0x80); // cmp byte [rdi+rax+key], 0
+			emit8(e, 0xBC);
+			emit8(e, 0x07);
+			emit32(e, OFF_KEY);
+			emit8(e, 0);
+			emit_select_pc(e, (opcode & 0x000F) == 0x000E ? CC_NE : CC_E, pc + 4, pc + 2);
+			break;
+		
+		case 0xF000:
+			switch(opcode & 0x00FF)
+			{
+				// FX1E I +=Vx
+				case 0x001E:
+					emit8(e, 0x66); // add word [rdi+I], Vx
+					emit_rex(e, rx, 0);
+					emit8(e, 0x01);
+					emit8(e, 0x80 | (rx & 7) << 3 | RDI);
+					emit32(e, OFF_I);
+					break;
+				
+				// FX29 I=sprite_addr[Vx]
+				case 0x0029:
+					if(rx >= 8) emit8(e, 0x43); // lea eax, [Vx+Vx*4+0x50]
+					emit8(e, 0x8D);
+					emit8(e, 0x84);
+					emit8(e, 0x80 | (rx & 7) << 3 | (rx & 7));
+					emit32(e, 0x50);
+					emit_store16(e, OFF_I, RAX);
+					break;
+			}
+			break;
+	}
+}
+
+// callee-saved host register
+static bool jit_saved(int r)
+{
+	return r == RBX || r == RBP || r >= 12;
+}
+
+// forget a block and the memory it covers
+static void jit_drop(chip8_jit_t *j, unsigned short start)
+{
+	jit_block_t *b = &j->blocks[start];
+	for(int i = 0; i < b->size; i++) if(!--j->cover[start + i]) j->until[start + i] &= ~CHIP8_UNTIL_CODE;
+	j->until[start] &= ~CHIP8_UNTIL_RUN;
+	b->compiled = false;
+	j->entry[start] = j->code;
+}
+
+// compile the block starting at address start
+static void jit_compile(chip8_jit_t *j, unsigned short start)
+{
+	chip8_t *c = j->c;
+	jit_block_t *b = &j->blocks[start];
+	unsigned short ops[JIT_BLOCK_MAX];
+	unsigned short uses = 0;
+	unsigned short pc = start;
+	int len = 0;
+	bool end = false;
+	
+	// make room for the code
+	if(j->used + JIT_BLOCK_BYTES > JIT_CODE_SIZE) chip8_jit_flush(j);
+	
+	// collect straight-line instructions up to a jump, call, return or skip
+	while(len < JIT_BLOCK_MAX && pc < 0x0FFF)
+	{
+		unsigned short opcode = c->memory[pc] << 8 | c->memory[pc + 1];
+		unsigned short u;
+		int kind = jit_classify(opcode, j->cowgod, &u);
+		if(kind == JIT_INTERPRET || __builtin_popcount(uses | u) > JIT_REGS) break;
+		uses |= u;
+		ops[len++] = opcode;
+		pc += 2;
+		if(kind == JIT_END)
+		{
+			end = true;
+			break;
+		}
+	}
+	
+	// remember which memory the decision was based on
+	b->compiled = true;
+	b->len = len;
+	b->size = len ? len*2 : 2;
+	if(start + b->size > 0x1000) b->size = 0x1000 - start;
+	for(int i = 0; i < b->size; i++)
+	{
+		j->cover[start + i]++;
+		j->until[start + i] |= CHIP8_UNTIL_CODE;
+	}
+	if(!len)
+	{
+		j->until[start] |= CHIP8_UNTIL_RUN; // starts with an instruction for the interpreter
+		return;
+	}
+	
+	// assign host registers
+	jit_emit_t e;
+	e.p = j->code + j->used;
+	e.nhost = 0;
+	e.cowgod = j->cowgod;
+	memset(e.dirty, 0, sizeof(e.dirty));
+	for(int v = 0; v < 16; v++) e.host[v] = (uses >> v & 1) ? jit_regs[e.nhost++] : -1;
+	
+	// leave through the stub if the budget is too small, otherwise take our cycles
+	emit8(&e, 0x81); // cmp esi, len
+	emit8(&e, 0xFE);
+	emit32(&e, len);
+	emit8(&e, 0x0F); // jb stub
+	emit8(&e, 0x82);
+	emit32(&e, j->code - (e.p + 4));
+	emit_alu_imm(&e, ALU_SUB, RSI, len);
+	
+	// prologue: save callee-saved registers and load V registers
+	for(int i = 0; i < e.nhost; i++) if(jit_saved(jit_regs[i])) emit_push(&e, jit_regs[i], false);
+	for(int v = 0; v < 16; v++) if(e.host[v] >= 0) emit_load8(&e, e.host[v], OFF_V + v);
+	
+	// body
+	for(int i = 0; i < len; i++) jit_emit_op(&e, ops[i], start + i*2);
+	if(!end) emit_store16_imm(&e, OFF_PC, pc);
+	
+	// epilogue: store changed V registers and restore callee-saved registers
+	for(int v = 0; v < 16; v++) if(e.dirty[v]) emit_store8(&e, OFF_V + v, e.host[v]);
+	emit_store16_imm(&e, OFF_OPCODE, ops[len - 1]);
+	for(int i = e.nhost - 1; i >= 0; i--) if(jit_saved(jit_regs[i])) emit_push(&e, jit_regs[i], true);
+	
+	// continue at the entry of the new pc, through the stub if it is out of range
+	emit_load16_eax(&e, OFF_PC);
+	emit8(&e, 0x3D); // cmp eax, 0xFFF
+	emit32(&e, 0xFFF);
+	emit8(&e, 0x0F); // ja stub
+	emit8(&e, 0x87);
+	emit32(&e, j->code - (e.p + 4));
+	emit8(&e, 0x48); // mov rcx, entry
+	emit8(&e, 0xB9);
+	void *table = j->entry;
+	memcpy(e.p, &table, 8);
+	e.p += 8;
+	emit8(&e, 0xFF); // jmp [rcx+rax*8]
+	emit8(&e, 0x24);
+	emit8(&e, 0xC1);
+	
+	j->entry[start] = j->code + j->used;
+	j->used = (e.p - j->code + 15) & ~(size_t)15;
+}
+
+// drop all blocks compiled from a memory address
+static void jit_invalidate(chip8_jit_t *j, unsigned short addr)
+{
+	addr &= 0xFFF;
+	if(!j->cover[addr]) return;
+	int first = addr - (2*JIT_BLOCK_MAX - 1);
+	for(int pc = first < 0 ? 0 : first; pc <= addr; pc++)
+	{
+		jit_block_t *b = &j->blocks[pc];
+		if(b->compiled && pc + b->size > addr) jit_drop(j, pc);
+	}
+}
+
+// create a compiler for a machine, returns NULL if no executable memory
+chip8_jit_t *chip8_jit_create(chip8_t *c)
+{
+	chip8_jit_t *j = calloc(1, sizeof(chip8_jit_t));
+	if(j == NULL) return NULL;
+	j->c = c;
+	j->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(j->code == MAP_FAILED)
+	{
+		free(j);
+		return NULL;
+	}
+	memcpy(j->code, jit_stub, sizeof(jit_stub));
+	chip8_jit_flush(j);
+	return j;
+}
+
+// release a compiler and its code
+void chip8_jit_destroy(chip8_jit_t *j)
+{
+	munmap(j->code, JIT_CODE_SIZE);
+	free(j);
+}
+
+// drop all compiled code
+void chip8_jit_flush(chip8_jit_t *j)
+{
+	memset(j->blocks, 0, sizeof(j->blocks));
+	memset(j->cover, 0, sizeof(j->cover));
+	memset(j->until, 0, sizeof(j->until));
+	for(int i = 0; i < 4096; i++) j->entry[i] = j->code;
+	j->used = 16; // keep the exit stub
+}
+
+// emulate n cpu cycles, running compiled blocks where possible
+bool chip8_jit_run(chip8_jit_t *j, unsigned int n, bool screen_wrap, bool cowgod)
+{
+	chip8_t *c = j->c;
+	bool draw = false;
+	
+	// SCHIP and XO-CHIP decode opcodes differently, they always run interpreted
+	if(c->mode != CHIP8_MODE_CHIP8) return chip8_run(c, n, screen_wrap, cowgod);
+	
+	// blocks with shifts are compiled for one setting of Cowgod-syntax
+	if(cowgod != j->cowgod)
+	{
+		chip8_jit_flush(j);
+		j->cowgod = cowgod;
+	}
+	
+	while(n)
+	{
+		// run native code from pc until it needs the interpreter or the budget runs out
+		unsigned short pc = c->pc;
+		if(pc < 0x1000)
+		{
+			jit_block_t *b = &j->blocks[pc];
+			if(!b->compiled) jit_compile(j, pc);
+			if(b->len && b->len <= n)
+			{
+				unsigned int left = ((jit_code_t)j->entry[pc])(c, n);
+				c->cycles += n - left;
+				n = left;
+				continue;
+			}
+		}
+		
+		// interpret up to the next address with a compiled or unknown block,
+		// or a write to compiled memory, and drop the blocks that write hit
+		unsigned long long cycles = c->cycles;
+		draw |= chip8_run_until(c, n, screen_wrap, cowgod, j->until);
+		n -= c->cycles - cycles;
+		unsigned short opcode = c->opcode, x = (opcode & 0x0F00) >> 8;
+		if((opcode & 0xF0FF) == 0xF033) for(int i = 0; i < 3; i++) jit_invalidate(j, c->I + i);
+		else if((opcode & 0xF0FF) == 0xF055)
+		{
+			unsigned short I = cowgod ? c->I : c->I - x - 1; // I before the instruction
+			for(int i = 0; i <= x; i++) jit_invalidate(j, I + i);
+		}
+	}
+	return draw;
+}
+
+#else
+
+// compiler state: without a code generator only the machine is kept
+struct chip8_jit_t
+{
+	chip8_t *c; // machine
+};
+
+// create a compiler for a machine
+chip8_jit_t *chip8_jit_create(chip8_t *c)
+{
+	chip8_jit_t *j = calloc(1, sizeof(chip8_jit_t));
+	if(j != NULL) j->c = c;
+	return j;
+}
+
+// release a compiler
+void chip8_jit_destroy(chip8_jit_t *j)
+{
+	free(j);
+}
+
+// nothing compiled, nothing to drop
+void chip8_jit_flush(chip8_jit_t *j)
+{
+	(void)j;
+}
+
+// emulate n cpu cycles with the predecoded interpreter
+bool chip8_jit_run(chip8_jit_t *j, unsigned int n, bool screen_wrap, bool cowgod)
+{
+	return chip8_run(j->c, n, screen_wrap, cowgod);
+}
+
+#endif
@@ -0,0 +1,21 @@
+/******************************************************************************
+chip8_jit.h
+CHIP-8 basic block compiler for x86-64.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// compiler state for one machine
+typedef struct chip8_jit_t chip8_jit_t;
+
+// create a compiler for a machine, returns NULL if no executable memory
+chip8_jit_t *chip8_jit_create(chip8_t *c);
+
+// release a compiler and its code
+void chip8_jit_destroy(chip8_jit_t *j);
+
+// drop all compiled code, needed after memory was changed from outside
+void chip8_jit_flush(chip8_jit_t *j);
+
+// emulate n cpu cycles, running compiled blocks where possible
+bool chip8_jit_run(chip8_jit_t *j, unsigned int n, bool screen_wrap, bool cowgod);
@@ -0,0 +1,659 @@
+/******************************************************************************
+chip8_lanes.c
+CHIP-8 lockstep interpreter: many machines running the same rom side by side
+in the lanes of vector registers.
+
+The machines are kept as a structure of arrays: register V0 of all lanes is
+one vector, V1 the next and so on. Lanes at the same pc form a group that
+fetches and decodes the instruction once, arithmetic and skips then run on
+all lanes at once with GCC vector extensions (AVX2 or SSE2, whatever the
+target has) and the group mask blended in. Timer ticks are worked out once
+for a group whose lanes share a clock. Drawing, random numbers, keys and
+memory access go lane by lane.
+
+The lowest pc leads: its group runs until its lanes take different ways at
+a skip, a return or BNNN, until it reaches a pc where other lanes wait, or
+until a lane runs out of instructions. Lanes that split off wait at a higher
+pc until the leading group catches up with them, which for the usual loops
+of a game is a few instructions later. Code the lanes changed themselves is
+checked lane by lane before it runs. Every lane ends exactly as chip8_cycle
+would leave its machine, which stays the reference.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "chip8.h"
+#include "chip8_lanes.h"
+
+// one value per lane
+typedef unsigned char lanes_u8 __attribute__((vector_size(CHIP8_LANES)));
+typedef unsigned short lanes_u16 __attribute__((vector_size(2*CHIP8_LANES)));
+typedef unsigned int lanes_u32 __attribute__((vector_size(4*CHIP8_LANES)));
+typedef unsigned long long lanes_u64 __attribute__((vector_size(CHIP8_LANES))); // a lanes_u8 in words
+
+// loop over the lanes of a lane mask
+#define FOR_LANES(i, mask) for(unsigned long long m_ = (mask); m_; m_ &= m_ - 1) for(int i = __builtin_ctzll(m_), o_ = 1; o_; o_ = 0)
+
+// new where the mask is set, old elsewhere
+#define BLEND(old, new, mask) (((new) & (mask)) | ((old) & ~(mask)))
+
+// lane set
+struct chip8_lanes_t
+{
+	// registers, element i belongs to lane i
+	lanes_u8 V[16]; // data registers
+	lanes_u16 I; // index registers
+	lanes_u32 keys; // pressed keys, bit k = key k
+
+	// per lane cpu state
+	unsigned short pc[CHIP8_LANES]; // program counters
+	unsigned short opcode[CHIP8_LANES]; // last opcodes
+	unsigned short sp[CHIP8_LANES]; // stack pointers
+	unsigned short stack[CHIP8_LANES][16]; // stacks
+	unsigned char keyflag[CHIP8_LANES]; // FX0A key state
+
+	// per lane timers and statistics, see chip8_t
+	unsigned long long delay_end[CHIP8_LANES]; // tick at which the delay timer reaches 0
+	unsigned long long sound_end[CHIP8_LANES]; // tick at which the sound timer reaches 0
+	unsigned long long sound_cycle[CHIP8_LANES]; // cycle at which FX18 last started the sound
+	unsigned long long tick_cycle[CHIP8_LANES]; // cycle count from which ticks are counted
+	unsigned long long tick_base[CHIP8_LANES]; // ticks before tick_cycle
+	unsigned int rate[CHIP8_LANES]; // instructions per second
+	unsigned long long rng[CHIP8_LANES]; // CXNN random number generator states
+	unsigned long long cycles[CHIP8_LANES]; // executed instructions
+	unsigned long unknown[CHIP8_LANES]; // unknown opcodes encountered
+	unsigned long long used; // loaded lanes, bit i = lane i
+
+	// screens and memory
+	bool dirty; // lanes were loaded since diverged was built
+	unsigned char diverged[4096]; // 1 = the lanes may hold different bytes here
+	unsigned long long screen[CHIP8_LANES][32]; // 64x32 screens, leftmost pixel in the highest bit
+	unsigned char memory[CHIP8_LANES][4096]; // program memory
+};
+
+// create an empty lane set
+chip8_lanes_t *chip8_lanes_create(void)
+{
+#ifdef _WIN32
+	chip8_lanes_t *l = _aligned_malloc(sizeof(chip8_lanes_t), _Alignof(chip8_lanes_t));
+#else
+	chip8_lanes_t *l = aligned_alloc(_Alignof(chip8_lanes_t), sizeof(chip8_lanes_t));
+#endif
+	if(l == NULL) return NULL;
+	memset(l, 0, sizeof(chip8_lanes_t));
+	return l;
+}
+
+// release a lane set
+void chip8_lanes_destroy(chip8_lanes_t *l)
+{
+#ifdef _WIN32
+	_aligned_free(l);
+#else
+	free(l);
+#endif
+}
+
+// load a CHIP-8 machine into a lane
+bool chip8_lanes_set(chip8_lanes_t *l, int lane, const chip8_t *c)
+{
+	if(c->mode != CHIP8_MODE_CHIP8) return 1;
+
+	unsigned int keys = 0;
+	for(int k = 0; k < 16; k++) keys |= (c->key[k] != 0) << k;
+	for(int r = 0; r < 16; r++) l->V[r][lane] = c->V[r];
+	l->I[lane] = c->I;
+	l->keys[lane] = keys;
+
+	l->pc[lane] = c->pc;
+	l->opcode[lane] = c->opcode;
+	l->sp[lane] = c->sp;
+	memcpy(l->stack[lane], c->stack, sizeof(c->stack));
+	l->keyflag[lane] = c->keyflag;
+
+	l->delay_end[lane] = c->delay_end;
+	l->sound_end[lane] = c->sound_end;
+	l->sound_cycle[lane] = c->sound_cycle;
+	l->tick_cycle[lane] = c->tick_cycle;
+	l->tick_base[lane] = c->tick_base;
+	l->rate[lane] = c->rate;
+	l->rng[lane] = c->rng;
+	l->cycles[lane] = c->cycles;
+	l->unknown[lane] = c->unknown;
+
+	for(int y = 0; y < 32; y++) l->screen[lane][y] = c->screen[0][y][0];
+	memcpy(l->memory[lane], c->memory, 4096);
+	l->used |= 1ULL << lane;
+	l->dirty = true;
+	return 0;
+}
+
+// copy a lane back into a machine
+void chip8_lanes_get(const chip8_lanes_t *l, int lane, chip8_t *c)
+{
+	chip8_setmode(c, CHIP8_MODE_CHIP8);
+	c->hires = false;
+	c->planes = 1;
+
+	for(int k = 0; k < 16; k++) c->key[k] = l->keys[lane] >> k & 1;
+	for(int r = 0; r < 16; r++) c->V[r] = l->V[r][lane];
+	c->I = l->I[lane];
+
+	c->pc = l->pc[lane];
+	c->opcode = l->opcode[lane];
+	c->sp = l->sp[lane];
+	memcpy(c->stack, l->stack[lane], sizeof(c->stack));
+	c->keyflag = l->keyflag[lane];
+
+	c->delay_end = l->delay_end[lane];
+	c->sound_end = l->sound_end[lane];
+	c->sound_cycle = l->sound_cycle[lane];
+	c->tick_cycle = l->tick_cycle[lane];
+	c->tick_base = l->tick_base[lane];
+	c->rate = l->rate[lane];
+	c->rng = l->rng[lane];
+	c->cycles = l->cycles[lane];
+	c->unknown = l->unknown[lane];
+
+	memset(c->screen, 0, sizeof(c->screen));
+	for(int y = 0; y < 32; y++) c->screen[0][y][0] = l->screen[lane][y];
+	memcpy(c->memory, l->memory[lane], 4096);
+	memset(c->decoded, 0, sizeof(c->decoded));
+}
+
+// set the keys of a lane
+void chip8_lanes_keys(chip8_lanes_t *l, int lane, unsigned short keys)
+{
+	l->keys[lane] = keys;
+}
+
+// mark the bytes in which the loaded lanes differ
+static void lanes_compare(chip8_lanes_t *l)
+{
+	memset(l->diverged, 0, sizeof(l->diverged));
+	if(l->used)
+	{
+		int first = __builtin_ctzll(l->used);
+		FOR_LANES(i, l->used)
+		{
+			for(int a = 0; a < 4096; a++) l->diverged[a] |= l->memory[i][a] != l->memory[first][a];
+		}
+	}
+	l->dirty = false;
+}
+
+// true if no lane of v is set
+static inline bool lanes_none(const lanes_u8 *v)
+{
+	const lanes_u64 w = (lanes_u64)*v;
+	unsigned long long any = 0;
+	for(int i = 0; i < CHIP8_LANES/8; i++) any |= w[i];
+	return !any;
+}
+
+// opcode at pc in the memory of a lane
+static inline unsigned short lanes_fetch(const chip8_lanes_t *l, int i, unsigned short pc)
+{
+	return l->memory[i][pc & 0xFFF] << 8 | l->memory[i][(pc + 1) & 0xFFF];
+}
+
+// true if the lanes may hold different instructions at pc
+static inline bool lanes_diverged(const chip8_lanes_t *l, unsigned short pc)
+{
+	return l->diverged[pc & 0xFFF] | l->diverged[(pc + 1) & 0xFFF];
+}
+
+// write a byte to the memory of a lane
+static inline void lanes_write(chip8_lanes_t *l, int i, unsigned short addr, unsigned char value)
+{
+	l->memory[i][addr & 0xFFF] = value;
+	l->diverged[addr & 0xFFF] = 1;
+}
+
+// after lanes jumped one by one: true and their pc if they all went the same way
+static inline bool lanes_same(const chip8_lanes_t *l, unsigned long long group, unsigned short *pc)
+{
+	unsigned short p = l->pc[__builtin_ctzll(group)];
+	FOR_LANES(i, group)
+	{
+		if(l->pc[i] != p) return false;
+	}
+	*pc = p;
+	return true;
+}
+
+// skip where the lanes of cond are set, returns false if the group splits
+static inline bool lanes_skip(chip8_lanes_t *l, unsigned long long group, lanes_u8 *cond, const lanes_u8 *m8, unsigned short *pc)
+{
+	*cond &= *m8;
+	lanes_u8 taken = *cond ^ *m8;
+	if(lanes_none(cond)) *pc += 2;
+	else if(lanes_none(&taken)) *pc += 4;
+	else
+	{
+		FOR_LANES(i, group) l->pc[i] = *pc + ((*cond)[i] ? 4 : 2);
+		return false;
+	}
+	return true;
+}
+
+// timer clock of a group
+typedef struct lanes_clock_t
+{
+	bool shared; // all lanes have the same cycle count, rate and tick origin
+	unsigned long long tick; // ticks of the shared clock
+	unsigned long long next; // k at which tick is out of date
+} lanes_clock_t;
+
+// 60Hz ticks of every lane of a group after k more instructions, see chip8_ticks.
+// a shared clock is worked out once per tick for the whole group
+static void lanes_ticks(const chip8_lanes_t *l, unsigned long long group, unsigned int k, lanes_clock_t *clock, unsigned long long now[CHIP8_LANES])
+{
+	if(!clock->shared)
+	{
+		FOR_LANES(i, group) now[i] = l->tick_base[i] + ((l->cycles[i] + k - l->tick_cycle[i] + 1)*60 - 1)/l->rate[i];
+		return;
+	}
+	if(k >= clock->next)
+	{
+		int i = __builtin_ctzll(group);
+		unsigned long long ran = l->cycles[i] - l->tick_cycle[i]; // instructions since the tick origin
+		clock->tick = ((ran + k + 1)*60 - 1)/l->rate[i];
+		clock->next = ((clock->tick + 1)*l->rate[i] + 60)/60 - 1 - ran; // first k of the next tick
+		clock->tick += l->tick_base[i];
+	}
+	FOR_LANES(i, group) now[i] = clock->tick;
+}
+
+// next value of the random number generator of a lane (splitmix64), see chip8_rand
+static inline unsigned int lanes_rand(chip8_lanes_t *l, int i)
+{
+	unsigned long long z = (l->rng[i] += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return (unsigned int)((z ^ (z >> 31)) >> 32);
+}
+
+// draw an n row sprite from memory at I on the screen of a lane, VF is set on
+// collision, see chip8_draw
+static void lanes_draw(chip8_lanes_t *l, int i, unsigned char xs, unsigned char ys, unsigned char n, bool screen_wrap)
+{
+	unsigned long long *screen = l->screen[i], collision = 0;
+	unsigned short I = l->I[i];
+
+	// without wrapping sprites starting off screen are not drawn
+	if(!screen_wrap && xs >= 64) n = 0;
+
+	for(int y = 0; y < n; y++)
+	{
+		unsigned long long row = (unsigned long long)l->memory[i][(I + y) & 0xFFF] << 56;
+		if(screen_wrap) row = row >> (xs & 63) | row << ((64 - (xs & 63)) & 63);
+		else if(y + ys < 32) row >>= xs;
+		else break;
+		collision |= screen[(y + ys) % 32] & row;
+		screen[(y + ys) % 32] ^= row;
+	}
+	l->V[0xF][i] = collision != 0;
+}
+
+// emulate n cpu cycles on every loaded lane
+bool chip8_lanes_run(chip8_lanes_t *l, unsigned int n, bool screen_wrap, bool cowgod)
+{
+	if(l->dirty) lanes_compare(l);
+	bool drawn = false;
+	unsigned long long end[CHIP8_LANES]; // cycle count each lane stops at
+	for(int i = 0; i < CHIP8_LANES; i++) end[i] = l->cycles[i] + n;
+
+	for(;;)
+	{
+		// the lanes with instructions left, the lowest pc leads
+		unsigned long long live = 0;
+		unsigned int leader = 0x10000;
+		for(int i = 0; i < CHIP8_LANES; i++)
+		{
+			if(!(l->used >> i & 1) || l->cycles[i] >= end[i]) continue;
+			live |= 1ULL << i;
+			if(l->pc[i] < leader) leader = l->pc[i];
+		}
+		if(!live) break;
+
+		// the group at the leader runs, the other lanes wait at a higher pc
+		// until it reaches them. it runs at most as far as its lane with the
+		// fewest instructions left.
+		unsigned long long group = 0, limit = ~0ULL;
+		unsigned int wait = 0x10000;
+		FOR_LANES(i, live)
+		{
+			if(l->pc[i] != leader)
+			{
+				if(l->pc[i] < wait) wait = l->pc[i];
+				continue;
+			}
+			group |= 1ULL << i;
+			if(end[i] - l->cycles[i] < limit) limit = end[i] - l->cycles[i];
+		}
+
+		// code the lanes may have changed must match the first lane's
+		int first = __builtin_ctzll(group);
+		unsigned short pc = leader;
+		if(lanes_diverged(l, pc))
+		{
+			unsigned short opcode = lanes_fetch(l, first, pc);
+			FOR_LANES(i, group)
+			{
+				if(lanes_fetch(l, i, pc) != opcode) group &= ~(1ULL << i), wait = leader;
+			}
+		}
+
+		// group masks
+		lanes_u8 m8;
+		lanes_u16 m16;
+		for(int i = 0; i < CHIP8_LANES; i++)
+		{
+			m8[i] = group >> i & 1 ? 0xFF : 0;
+			m16[i] = group >> i & 1 ? 0xFFFF : 0;
+		}
+
+		// run the group until it splits, meets waiting lanes or changed code,
+		// or runs out of instructions. k instructions ran so far.
+		unsigned long long now[CHIP8_LANES]; // timer ticks per lane
+		lanes_clock_t clock = {true, 0, 0};
+		FOR_LANES(i, group)
+		{
+			clock.shared &= l->cycles[i] == l->cycles[first] && l->rate[i] == l->rate[first] &&
+				l->tick_cycle[i] == l->tick_cycle[first] && l->tick_base[i] == l->tick_base[first];
+		}
+		unsigned long long park = 0, stuck = 0; // lanes waiting in FX0A or stuck at an unknown opcode for the rest of the run
+		const unsigned char *memory = l->memory[first];
+		unsigned short opcode;
+		unsigned int k = 0;
+		bool same = true; // all lanes of the group are at pc
+		do
+		{
+			opcode = memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF];
+			int x = (opcode & 0x0F00) >> 8, y = (opcode & 0x00F0) >> 4;
+			unsigned char nn = opcode & 0x00FF;
+			unsigned short nnn = opcode & 0x0FFF;
+			lanes_u8 *V = l->V, cond;
+
+			switch(opcode >> 12)
+			{
+				case 0x0:
+					// 00E0 clear
+					if((opcode & 0x000F) == 0x0000)
+					{
+						FOR_LANES(i, group) memset(l->screen[i], 0, sizeof(l->screen[i]));
+						drawn = true;
+						pc += 2;
+					}
+
+					// 00EE return
+					else if((opcode & 0x000F) == 0x000E)
+					{
+						FOR_LANES(i, group)
+						{
+							l->sp[i]--;
+							l->pc[i] = l->stack[i][l->sp[i] & 0xF];
+						}
+						same = lanes_same(l, group, &pc);
+					}
+					else stuck = group;
+					break;
+
+				// 1NNN jump
+				case 0x1:
+					pc = nnn;
+					break;
+
+				// 2NNN call
+				case 0x2:
+					FOR_LANES(i, group)
+					{
+						l->stack[i][l->sp[i] & 0xF] = pc + 2;
+						l->sp[i]++;
+					}
+					pc = nnn;
+					break;
+
+				// 3XNN, 4XNN, 5XY0 and 9XY0 skips
+				case 0x3:
+					cond = (lanes_u8)(V[x] == nn);
+					same = lanes_skip(l, group, &cond, &m8, &pc);
+					break;
+				case 0x4:
+					cond = (lanes_u8)(V[x] != nn);
+					same = lanes_skip(l, group, &cond, &m8, &pc);
+					break;
+				case 0x5:
+					cond = (lanes_u8)(V[x] == V[y]);
+					same = lanes_skip(l, group, &cond, &m8, &pc);
+					break;
+				case 0x9:
+					cond = (lanes_u8)(V[x] != V[y]);
+					same = lanes_skip(l, group, &cond, &m8, &pc);
+					break;
+
+				// 6XNN and 7XNN constants
+				case 0x6:
+					V[x] = BLEND(V[x], nn, m8);
+					pc += 2;
+					break;
+				case 0x7:
+					V[x] = BLEND(V[x], V[x] + nn, m8);
+					pc += 2;
+					break;
+
+				// 8XYN arithmetic, VF is written before VX like chip8_cycle does
+				case 0x8:
+					switch(opcode & 0x000F)
+					{
+						case 0x0:
+							V[x] = BLEND(V[x], V[y], m8);
+							break;
+						case 0x1:
+							V[x] = BLEND(V[x], V[x] | V[y], m8);
+							break;
+						case 0x2:
+							V[x] = BLEND(V[x], V[x] & V[y], m8);
+							break;
+						case 0x3:
+							V[x] = BLEND(V[x], V[x] ^ V[y], m8);
+							break;
+						case 0x4:
+							V[0xF] = BLEND(V[0xF], (lanes_u8)(V[x] + V[y] < V[x]) & 1, m8);
+							V[x] = BLEND(V[x], V[x] + V[y], m8);
+							break;
+						case 0x5:
+							V[0xF] = BLEND(V[0xF], (lanes_u8)(V[x] >= V[y]) & 1, m8);
+							V[x] = BLEND(V[x], V[x] - V[y], m8);
+							break;
+						case 0x6:
+							if(cowgod)
+							{
+								V[0xF] = BLEND(V[0xF], V[x] & 1, m8);
+								V[x] = BLEND(V[x], V[x] >> 1, m8);
+							}
+							else
+							{
+								V[0xF] = BLEND(V[0xF], V[y] & 1, m8);
+								V[y] = BLEND(V[y], V[y] >> 1, m8);
+								V[x] = BLEND(V[x], V[y], m8);
+							}
+							break;
+						case 0x7:
+							V[0xF] = BLEND(V[0xF], (lanes_u8)(V[x] <= V[y]) & 1, m8);
+							V[x] = BLEND(V[x], V[y] - V[x], m8);
+							break;
+						case 0xE:
+							if(cowgod)
+							{
+								V[0xF] = BLEND(V[0xF], V[x] >> 7, m8);
+								V[x] = BLEND(V[x], V[x] << 1, m8);
+							}
+							else
+							{
+								V[0xF] = BLEND(V[0xF], V[y] >> 7, m8);
+								V[y] = BLEND(V[y], V[y] << 1, m8);
+								V[x] = BLEND(V[x], V[y], m8);
+							}
+							break;
+						default:
+							stuck = group;
+							pc -= 2;
+					}
+					pc += 2;
+					break;
+
+				// ANNN index
+				case 0xA:
+					l->I = BLEND(l->I, nnn, m16);
+					pc += 2;
+					break;
+
+				// BNNN jump with offset
+				case 0xB:
+					FOR_LANES(i, group) l->pc[i] = nnn + V[0][i];
+					same = lanes_same(l, group, &pc);
+					break;
+
+				// CXNN random
+				case 0xC:
+					FOR_LANES(i, group) V[x][i] = (lanes_rand(l, i) % 256) & nn;
+					pc += 2;
+					break;
+
+				// DXYN draw
+				case 0xD:
+					FOR_LANES(i, group) lanes_draw(l, i, V[x][i], V[y][i], opcode & 0x000F, screen_wrap);
+					drawn = true;
+					pc += 2;
+					break;
+
+				// EX9E and EXA1 key skips
+				case 0xE:
+					cond = __builtin_convertvector(l->keys >> __builtin_convertvector(V[x] & 0xF, lanes_u32) & 1, lanes_u8);
+					if((opcode & 0x000F) == 0x000E) cond = -cond;
+					else if((opcode & 0x000F) == 0x0001) cond = cond - 1;
+					else
+					{
+						stuck = group;
+						break;
+					}
+					same = lanes_skip(l, group, &cond, &m8, &pc);
+					break;
+
+				case 0xF:
+					switch(nn)
+					{
+						// FX07 read the delay timer
+						case 0x07:
+							lanes_ticks(l, group, k, &clock, now);
+							FOR_LANES(i, group) V[x][i] = l->delay_end[i] > now[i] ? l->delay_end[i] - now[i] : 0;
+							break;
+
+						// FX0A wait for a key press and release, lanes still
+						// waiting wait for the rest of the run as their keys
+						// can't change before it ends
+						case 0x0A:
+							FOR_LANES(i, group)
+							{
+								unsigned int keys = l->keys[i];
+								if(l->keyflag[i] == 16 && keys) l->keyflag[i] = __builtin_ctz(keys);
+								if(l->keyflag[i] != 16 && !(keys >> l->keyflag[i] & 1))
+								{
+									V[x][i] = l->keyflag[i];
+									l->keyflag[i] = 16;
+									l->pc[i] = pc + 2;
+								}
+								else
+								{
+									l->pc[i] = pc;
+									park |= 1ULL << i;
+								}
+							}
+							same = false;
+							break;
+
+						// FX15 and FX18 set the delay and sound timers
+						case 0x15:
+							lanes_ticks(l, group, k, &clock, now);
+							FOR_LANES(i, group) l->delay_end[i] = now[i] + V[x][i];
+							break;
+						case 0x18:
+							lanes_ticks(l, group, k, &clock, now);
+							FOR_LANES(i, group)
+							{
+								if(l->sound_end[i] <= now[i]) l->sound_cycle[i] = l->cycles[i] + k;
+								l->sound_end[i] = now[i] + V[x][i];
+							}
+							break;
+
+						// FX1E and FX29 index
+						case 0x1E:
+							l->I = BLEND(l->I, l->I + __builtin_convertvector(V[x], lanes_u16), m16);
+							break;
+						case 0x29:
+							l->I = BLEND(l->I, 0x50 + __builtin_convertvector(V[x], lanes_u16)*5, m16);
+							break;
+
+						// FX33 BCD, FX55 and FX65 store and load registers
+						case 0x33:
+							FOR_LANES(i, group)
+							{
+								lanes_write(l, i, l->I[i], V[x][i] / 100);
+								lanes_write(l, i, l->I[i] + 1, (V[x][i] / 10) % 10);
+								lanes_write(l, i, l->I[i] + 2, V[x][i] % 10);
+							}
+							break;
+						case 0x55:
+							FOR_LANES(i, group)
+							{
+								for(int r = 0; r <= x; r++) lanes_write(l, i, l->I[i] + r, V[r][i]);
+							}
+							if(!cowgod) l->I = BLEND(l->I, l->I + (unsigned short)(x + 1), m16);
+							break;
+						case 0x65:
+							FOR_LANES(i, group)
+							{
+								for(int r = 0; r <= x; r++) V[r][i] = l->memory[i][(l->I[i] + r) & 0xFFF];
+							}
+							if(!cowgod) l->I = BLEND(l->I, l->I + (unsigned short)(x + 1), m16);
+							break;
+
+						default:
+							stuck = group;
+							pc -= 2;
+					}
+					if(same) pc += 2;
+					break;
+			}
+			k++;
+		}
+		while(same && !stuck && k < limit && pc < wait && !lanes_diverged(l, pc));
+
+		// bring the lanes of the group up to date
+		FOR_LANES(i, group)
+		{
+			if(same) l->pc[i] = pc;
+			l->opcode[i] = opcode;
+			l->cycles[i] += k;
+		}
+
+		// lanes that can't continue in this run skip to its end, an unknown
+		// opcode counts again every cycle
+		FOR_LANES(i, park | stuck)
+		{
+			if(stuck >> i & 1) l->unknown[i] += end[i] - l->cycles[i] + 1;
+			l->cycles[i] = end[i];
+		}
+	}
+	return drawn;
+}
@@ -0,0 +1,34 @@
+/******************************************************************************
+chip8_lanes.h
+CHIP-8 lockstep interpreter: many machines running the same rom side by side
+in the lanes of vector registers.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// machines per lane set, a power of 2
+#define CHIP8_LANES 32
+
+// lane set
+typedef struct chip8_lanes_t chip8_lanes_t;
+
+// create an empty lane set, returns NULL if out of memory
+chip8_lanes_t *chip8_lanes_create(void);
+
+// release a lane set
+void chip8_lanes_destroy(chip8_lanes_t *l);
+
+// load a CHIP-8 machine into a lane, usually one that was just reset and
+// seeded. returns 1 if the machine isn't in CHIP-8 mode.
+bool chip8_lanes_set(chip8_lanes_t *l, int lane, const chip8_t *c);
+
+// copy a lane back into a machine, everything but its host settings
+// (quiet, trace and profile). a compiler for the machine must be flushed.
+void chip8_lanes_get(const chip8_lanes_t *l, int lane, chip8_t *c);
+
+// set the keys of a lane, bit i = key i pressed
+void chip8_lanes_keys(chip8_lanes_t *l, int lane, unsigned short keys);
+
+// emulate n cpu cycles on every loaded lane, as chip8_cycle does on each
+// machine. returns 1 if any lane drew on its screen.
+bool chip8_lanes_run(chip8_lanes_t *l, unsigned int n, bool screen_wrap, bool cowgod);
@@ -0,0 +1,97 @@
+/******************************************************************************
+chip8_profile.c
+CHIP-8 profiler: instruction, address and drawing counters.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "chip8_profile.h"
+
+// create an empty profile
+chip8_profile_t *chip8_profile_create(void)
+{
+	return calloc(1, sizeof(chip8_profile_t));
+}
+
+// release a profile
+void chip8_profile_destroy(chip8_profile_t *p)
+{
+	free(p);
+}
+
+// end a frame: store the instructions and draws since the last one
+void chip8_profile_frame(chip8_profile_t *p, const chip8_t *c)
+{
+	// a reset or rewind goes back in cycles, count from there
+	unsigned long long cycles = c->cycles >= p->frame_cycle ? c->cycles - p->frame_cycle : c->cycles;
+	unsigned int i = p->frames++ % CHIP8_PROFILE_FRAMES;
+	p->frame_ops[i] = cycles;
+	p->frame_drawn[i] = p->draws - p->frame_draws;
+	p->frame_cycle = c->cycles;
+	p->frame_draws = p->draws;
+}
+
+// print the counters: instructions per handler, the hottest addresses, drawing and frames
+void chip8_profile_dump(const chip8_profile_t *p, const chip8_t *c, FILE *fp)
+{
+	// instructions per handler, most executed first
+	unsigned long long total = 0;
+	for(int i = 0; i < CHIP8_PROFILE_OPS; i++) total += p->ops[i];
+	fprintf(fp, "Profile of %llu instructions (%llu more skipped in idle loops)\n", total, p->skipped);
+	bool done[CHIP8_PROFILE_OPS] = {false};
+	while(total)
+	{
+		int best = -1;
+		for(int i = 0; i < CHIP8_PROFILE_OPS; i++) if(!done[i] && p->ops[i] && (best < 0 || p->ops[i] > p->ops[best])) best = i;
+		if(best < 0) break;
+		done[best] = true;
+		fprintf(fp, "  %-8s %12llu %5.1f%%\n", chip8_opname(best), p->ops[best], 100.0*p->ops[best]/total);
+	}
+
+	// hottest 16 addresses with the opcode found there now
+	fprintf(fp, "Hottest addresses\n");
+	unsigned long long last = ~0ULL;
+	int lastpc = -1;
+	for(int n = 0; n < 16; n++)
+	{
+		// next lower count, ties in address order
+		int best = -1;
+		for(int a = 0; a < 4096; a++)
+		{
+			unsigned long long v = p->pc[a];
+			if(!v || v > last || (v == last && a <= lastpc)) continue;
+			if(best < 0 || v > p->pc[best]) best = a;
+		}
+		if(best < 0) break;
+		last = p->pc[best];
+		lastpc = best;
+		fprintf(fp, "  %03X: %02X%02X %12llu %5.1f%%\n", best, c->memory[best], c->memory[(best + 1) & 0xFFF],
+			p->pc[best], total ? 100.0*p->pc[best]/(total + p->skipped) : 0);
+	}
+
+	// drawing
+	fprintf(fp, "DXYN: %llu draws, %llu pixels, %llu with collision\n", p->draws, p->pixels, p->collisions);
+
+	// per frame over the kept frames
+	unsigned int frames = p->frames < CHIP8_PROFILE_FRAMES ? p->frames : CHIP8_PROFILE_FRAMES;
+	if(frames)
+	{
+		unsigned long long ops = 0, drawn = 0;
+		unsigned int maxops = 0, maxdrawn = 0;
+		for(unsigned int i = 0; i < frames; i++)
+		{
+			ops += p->frame_ops[i];
+			drawn += p->frame_drawn[i];
+			if(p->frame_ops[i] > maxops) maxops = p->frame_ops[i];
+			if(p->frame_drawn[i] > maxdrawn) maxdrawn = p->frame_drawn[i];
+		}
+		fprintf(fp, "Last %u frames: %.1f instructions (max %u), %.1f draws (max %u) per frame\n",
+			frames, (double)ops/frames, maxops, (double)drawn/frames, maxdrawn);
+	}
+}
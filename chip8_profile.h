@@ -0,0 +1,44 @@
+/******************************************************************************
+chip8_profile.h
+CHIP-8 profiler: instruction, address and drawing counters.
+
+Counting is compiled in with -DCHIP8_PROFILE and done for a machine with a
+profile attached, by chip8_cycle and chip8_run. Without the define the
+counters cost nothing.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// counted instruction handlers, at least the number of predecoded handlers
+#define CHIP8_PROFILE_OPS 64
+
+// frames kept of the per frame counts
+#define CHIP8_PROFILE_FRAMES 128
+
+// counters of one machine
+typedef struct chip8_profile_t
+{
+	unsigned long long ops[CHIP8_PROFILE_OPS]; // executed instructions per handler, see chip8_opname
+	unsigned long long pc[4096]; // executed instructions per address, XO-CHIP memory above 4KB folds onto it
+	unsigned long long skipped; // instructions of idle loops skipped in one go, also counted at their jump
+	unsigned long long draws; // executed DXYN
+	unsigned long long pixels; // sprite pixels DXYN drew
+	unsigned long long collisions; // DXYN that turned a pixel off
+	unsigned long long frames; // frames ended so far
+	unsigned long long frame_cycle; // cycle count at the end of the last frame
+	unsigned long long frame_draws; // draws at the end of the last frame
+	unsigned int frame_ops[CHIP8_PROFILE_FRAMES]; // instructions per frame, ring by frame number
+	unsigned int frame_drawn[CHIP8_PROFILE_FRAMES]; // DXYN per frame, ring by frame number
+} chip8_profile_t;
+
+// create an empty profile, attach it by setting the machine's profile
+chip8_profile_t *chip8_profile_create(void);
+
+// release a profile
+void chip8_profile_destroy(chip8_profile_t *p);
+
+// end a frame: store the instructions and draws since the last one
+void chip8_profile_frame(chip8_profile_t *p, const chip8_t *c);
+
+// print the counters: instructions per handler, the hottest addresses, drawing and frames
+void chip8_profile_dump(const chip8_profile_t *p, const chip8_t *c, FILE *fp);
@@ -0,0 +1,308 @@
+/******************************************************************************
+chip8_rewind.c
+CHIP-8 rewind buffer: a bounded history of delta-compressed save states.
+
+Every frame is stored as the XOR of its state with the state of the frame
+before, run-length encoded: only the few bytes a frame changes (registers,
+some screen rows, a few memory bytes) take space. Every interval frames a full
+keyframe starts a new segment, encoded the same way against an all-zero state
+so the unused part of the 64KB memory costs nothing. The oldest segment is
+dropped as a whole when the data ring is full.
+
+Because XOR deltas work both ways, going back one frame from the newest just
+applies the newest delta once more. Any other frame is rebuilt forward from
+the keyframe of its segment.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "chip8_rewind.h"
+
+// maximum number of frames, 18 minutes at 60 frames per second
+#define REWIND_FRAMES (1 << 16)
+
+// stored frame
+typedef struct frame_t
+{
+	unsigned int offset; // start in the data ring
+	unsigned int size; // encoded size
+	bool key; // full state (a delta against blank) instead of a delta
+} frame_t;
+
+// all-zero state keyframes are encoded against
+static const chip8_state_t blank;
+
+// rewind history
+struct chip8_rewind_t
+{
+	unsigned char *data; // data ring
+	size_t capacity; // size of the data ring
+	size_t head; // next write position in the data ring
+	frame_t *frames; // frame ring
+	unsigned int first; // oldest frame
+	unsigned int count; // number of frames
+	unsigned int keys; // number of keyframes, one per segment
+	unsigned int interval; // frames per keyframe
+	unsigned int since_key; // frames since the newest keyframe
+	chip8_state_t last; // state of the newest frame
+	chip8_state_t work; // scratch state
+	unsigned char *buffer; // scratch encoding buffer
+};
+
+// worst case encoded size of a delta
+#define REWIND_MAXDELTA (sizeof(chip8_state_t) + sizeof(chip8_state_t)/4 + 16)
+
+// frame i counted from the oldest
+static frame_t *frame(const chip8_rewind_t *r, unsigned int i)
+{
+	return &r->frames[(r->first + i) & (REWIND_FRAMES - 1)];
+}
+
+// write a variable length number
+static unsigned char *put_number(unsigned char *p, size_t n)
+{
+	while(n >= 0x80)
+	{
+		*p++ = n | 0x80;
+		n >>= 7;
+	}
+	*p++ = n;
+	return p;
+}
+
+// read a variable length number
+static const unsigned char *get_number(const unsigned char *p, size_t *n)
+{
+	*n = 0;
+	for(int shift = 0; ; shift += 7)
+	{
+		*n |= (size_t)(*p & 0x7F) << shift;
+		if(!(*p++ & 0x80)) return p;
+	}
+}
+
+// encode the XOR of two states as (skip, length, bytes) runs
+static size_t encode_delta(unsigned char *out, const chip8_state_t *a, const chip8_state_t *b)
+{
+	const unsigned char *x = (const unsigned char*)a;
+	const unsigned char *y = (const unsigned char*)b;
+	size_t n = sizeof(chip8_state_t);
+	unsigned char *p = out;
+	size_t i = 0;
+	while(i < n)
+	{
+		// unchanged bytes, compared a word at a time
+		size_t start = i;
+		while(i + 8 <= n)
+		{
+			unsigned long long u, v;
+			memcpy(&u, x + i, 8);
+			memcpy(&v, y + i, 8);
+			if(u != v) break;
+			i += 8;
+		}
+		while(i < n && x[i] == y[i]) i++;
+		if(i == n) break;
+		size_t skip = i - start;
+
+		// changed bytes, short unchanged gaps are cheaper to keep in the run
+		size_t end = i;
+		while(end < n)
+		{
+			if(x[end] != y[end]) end++;
+			else if(end + 2 < n && (x[end+1] != y[end+1] || x[end+2] != y[end+2])) end++;
+			else break;
+		}
+		p = put_number(p, skip);
+		p = put_number(p, end - i);
+		for(; i < end; i++) *p++ = x[i] ^ y[i];
+	}
+	return p - out;
+}
+
+// apply an encoded XOR delta to a state
+static void apply_delta(chip8_state_t *s, const unsigned char *p, size_t size)
+{
+	unsigned char *x = (unsigned char*)s;
+	const unsigned char *end = p + size;
+	size_t i = 0;
+	while(p < end)
+	{
+		size_t skip, len;
+		p = get_number(p, &skip);
+		p = get_number(p, &len);
+		i += skip;
+		while(len--) x[i++] ^= *p++;
+	}
+}
+
+// rebuild the state of frame i counted from the oldest
+static void rebuild(chip8_rewind_t *r, unsigned int i, chip8_state_t *s)
+{
+	unsigned int k = i;
+	while(!frame(r, k)->key) k--;
+	memset(s, 0, sizeof(chip8_state_t));
+	for(; k <= i; k++) apply_delta(s, r->data + frame(r, k)->offset, frame(r, k)->size);
+}
+
+// drop the oldest segment: its keyframe and all deltas up to the next keyframe
+static void drop_segment(chip8_rewind_t *r)
+{
+	r->keys--;
+	do
+	{
+		r->first = (r->first + 1) & (REWIND_FRAMES - 1);
+		r->count--;
+	}
+	while(r->count && !frame(r, 0)->key);
+}
+
+// find room for size bytes in the data ring, returns false if the newest
+// segment would have to go
+static bool reserve(chip8_rewind_t *r, size_t size, size_t *offset)
+{
+	while(true)
+	{
+		// the ring is used from the oldest frame up to head
+		if(!r->count) r->head = 0;
+		if(r->count < REWIND_FRAMES)
+		{
+			size_t tail = r->count ? frame(r, 0)->offset : 0;
+			if(!r->count || r->head > tail)
+			{
+				if(r->head + size <= r->capacity)
+				{
+					*offset = r->head;
+					return true;
+				}
+				if(size < tail || (!r->count && size <= r->capacity))
+				{
+					*offset = 0;
+					return true;
+				}
+			}
+			else if(r->head + size < tail)
+			{
+				*offset = r->head;
+				return true;
+			}
+		}
+		if(r->keys < 2) return false;
+		drop_segment(r);
+	}
+}
+
+// create a history
+chip8_rewind_t *chip8_rewind_create(size_t bytes, unsigned int interval)
+{
+	chip8_rewind_t *r = calloc(1, sizeof(chip8_rewind_t));
+	if(r == NULL) return NULL;
+	r->data = malloc(bytes);
+	r->frames = malloc(REWIND_FRAMES*sizeof(frame_t));
+	r->buffer = malloc(REWIND_MAXDELTA);
+	if(r->data == NULL || r->frames == NULL || r->buffer == NULL)
+	{
+		chip8_rewind_destroy(r);
+		return NULL;
+	}
+	r->capacity = bytes;
+	r->interval = interval ? interval : 1;
+	return r;
+}
+
+// release a history
+void chip8_rewind_destroy(chip8_rewind_t *r)
+{
+	free(r->data);
+	free(r->frames);
+	free(r->buffer);
+	free(r);
+}
+
+// drop all history
+void chip8_rewind_clear(chip8_rewind_t *r)
+{
+	r->first = r->count = r->keys = 0;
+	r->head = 0;
+}
+
+// record the current state as the newest frame
+void chip8_rewind_push(chip8_rewind_t *r, const chip8_t *c)
+{
+	chip8_save(c, &r->work);
+
+	// a delta against the newest frame, or a keyframe
+	bool key = !r->count || r->since_key + 1 >= r->interval;
+	size_t size = encode_delta(r->buffer, &r->work, key ? &blank : &r->last);
+
+	// make room, start over if the newest segment alone fills the whole ring
+	size_t offset;
+	if(!reserve(r, size, &offset))
+	{
+		chip8_rewind_clear(r);
+		key = true;
+		size = encode_delta(r->buffer, &r->work, &blank);
+		if(!reserve(r, size, &offset)) return;
+	}
+
+	// store frame
+	memcpy(r->data + offset, r->buffer, size);
+	frame_t *f = frame(r, r->count++);
+	f->offset = offset;
+	f->size = size;
+	f->key = key;
+	r->head = offset + size;
+	r->keys += key;
+	r->since_key = key ? 0 : r->since_key + 1;
+	memcpy(&r->last, &r->work, sizeof(chip8_state_t));
+}
+
+// go back one frame
+bool chip8_rewind_pop(chip8_rewind_t *r, chip8_t *c)
+{
+	if(r->count < 2) return false;
+
+	// undo the newest delta, or rebuild the end of the previous segment
+	frame_t *f = frame(r, r->count - 1);
+	if(f->key) rebuild(r, r->count - 2, &r->last);
+	else apply_delta(&r->last, r->data + f->offset, f->size);
+	r->count--;
+	r->keys -= f->key;
+	r->head = f->offset;
+
+	// keyframe distance of the new newest frame
+	r->since_key = 0;
+	while(!frame(r, r->count - 1 - r->since_key)->key) r->since_key++;
+
+	chip8_restore(c, &r->last);
+	return true;
+}
+
+// restore an older frame
+bool chip8_rewind_seek(chip8_rewind_t *r, chip8_t *c, unsigned int back)
+{
+	if(back >= r->count) return false;
+	rebuild(r, r->count - 1 - back, &r->work);
+	chip8_restore(c, &r->work);
+	return true;
+}
+
+// number of frames in the history
+unsigned int chip8_rewind_frames(const chip8_rewind_t *r)
+{
+	return r->count;
+}
+
+// bytes of state data in use
+size_t chip8_rewind_size(const chip8_rewind_t *r)
+{
+	if(!r->count) return 0;
+	size_t tail = frame(r, 0)->offset;
+	return r->head > tail ? r->head - tail : r->capacity - tail + r->head;
+}
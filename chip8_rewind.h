@@ -0,0 +1,37 @@
+/******************************************************************************
+chip8_rewind.h
+CHIP-8 rewind buffer: a bounded history of delta-compressed save states.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// rewind history of one machine
+typedef struct chip8_rewind_t chip8_rewind_t;
+
+// create a history of at most bytes of state data with a full keyframe every
+// interval frames, returns NULL if out of memory
+chip8_rewind_t *chip8_rewind_create(size_t bytes, unsigned int interval);
+
+// release a history
+void chip8_rewind_destroy(chip8_rewind_t *r);
+
+// drop all history, needed after a reset or rom change
+void chip8_rewind_clear(chip8_rewind_t *r);
+
+// record the current state as the newest frame, the oldest frames are dropped
+// when the history is full
+void chip8_rewind_push(chip8_rewind_t *r, const chip8_t *c);
+
+// go back one frame: restore the frame before the newest and drop the newest,
+// returns false if there is no history left
+bool chip8_rewind_pop(chip8_rewind_t *r, chip8_t *c);
+
+// restore the frame back frames before the newest without dropping anything,
+// returns false if the history is not that long
+bool chip8_rewind_seek(chip8_rewind_t *r, chip8_t *c, unsigned int back);
+
+// number of frames in the history
+unsigned int chip8_rewind_frames(const chip8_rewind_t *r);
+
+// bytes of state data in use
+size_t chip8_rewind_size(const chip8_rewind_t *r);
@@ -0,0 +1,213 @@
+/******************************************************************************
+chip8_rom.c
+CHIP-8 rom cache: roms loaded once and shared by any number of machines.
+
+Every rom is kept as a pristine memory image, the fontsets and the rom as
+they are in memory right after loading, so a reset is one memcpy instead of
+opening and reading the file again. Files are mapped into memory rather than
+read into a buffer, and roms are found by a hash of their contents: the same
+rom under several names is stored once. Sizes are checked when a rom is
+added, not on every reset.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "chip8.h"
+#include "chip8_rom.h"
+
+// rom cache, an open addressing hash table of roms
+struct chip8_romcache_t
+{
+	chip8_rom_t **slots; // hash table, NULL = free
+	unsigned int capacity; // number of slots, a power of two
+	unsigned int count; // number of roms
+};
+
+// FNV-1a hash of a rom
+static unsigned long long rom_hash(const unsigned char *rom, size_t len)
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	for(size_t i = 0; i < len; i++)
+	{
+		hash ^= rom[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+// slot of a rom, or the free slot it goes in
+static chip8_rom_t **rom_slot(chip8_romcache_t *cache, unsigned long long hash, const unsigned char *rom, size_t len, unsigned char mode)
+{
+	unsigned int mask = cache->capacity - 1;
+	for(unsigned int i = hash & mask; ; i = (i + 1) & mask)
+	{
+		chip8_rom_t *r = cache->slots[i];
+		if(r == NULL) return &cache->slots[i];
+		if(r->hash == hash && r->len == len && r->mode == mode && !memcmp(&r->image[0x200], rom, len)) return &cache->slots[i];
+	}
+}
+
+// double the hash table
+static bool rom_grow(chip8_romcache_t *cache)
+{
+	chip8_rom_t **old = cache->slots;
+	unsigned int n = cache->capacity;
+	cache->slots = calloc(2*n, sizeof(chip8_rom_t*));
+	if(cache->slots == NULL)
+	{
+		cache->slots = old;
+		return false;
+	}
+	cache->capacity = 2*n;
+	for(unsigned int i = 0; i < n; i++)
+	{
+		chip8_rom_t *r = old[i];
+		if(r != NULL) *rom_slot(cache, r->hash, &r->image[0x200], r->len, r->mode) = r;
+	}
+	free(old);
+	return true;
+}
+
+// create an empty cache
+chip8_romcache_t *chip8_romcache_create(void)
+{
+	chip8_romcache_t *cache = calloc(1, sizeof(chip8_romcache_t));
+	if(cache == NULL) return NULL;
+	cache->capacity = 64;
+	cache->slots = calloc(cache->capacity, sizeof(chip8_rom_t*));
+	if(cache->slots == NULL)
+	{
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+// release a cache and all its roms
+void chip8_romcache_destroy(chip8_romcache_t *cache)
+{
+	for(unsigned int i = 0; i < cache->capacity; i++)
+	{
+		if(cache->slots[i] == NULL) continue;
+		free(cache->slots[i]->image);
+		free(cache->slots[i]);
+	}
+	free(cache->slots);
+	free(cache);
+}
+
+// add a rom image from a buffer
+const chip8_rom_t *chip8_romcache_add(chip8_romcache_t *cache, const unsigned char *rom, size_t len, unsigned char mode)
+{
+	// check for memory overflow
+	if(len > chip8_memsize(mode) - 0x200) return NULL;
+
+	// same contents already loaded
+	unsigned long long hash = rom_hash(rom, len);
+	chip8_rom_t **slot = rom_slot(cache, hash, rom, len, mode);
+	if(*slot != NULL) return *slot;
+
+	// keep the table at most half full
+	if(2*(cache->count + 1) > cache->capacity)
+	{
+		if(!rom_grow(cache)) return NULL;
+		slot = rom_slot(cache, hash, rom, len, mode);
+	}
+
+	// build the pristine memory image
+	chip8_rom_t *r = malloc(sizeof(chip8_rom_t));
+	if(r == NULL) return NULL;
+	r->hash = hash;
+	r->len = len;
+	r->mode = mode;
+	r->size = chip8_memsize(mode);
+	r->image = malloc(r->size);
+	if(r->image == NULL)
+	{
+		free(r);
+		return NULL;
+	}
+	chip8_image(r->image, mode, rom, len);
+	*slot = r;
+	cache->count++;
+	return r;
+}
+
+// add a rom file
+const chip8_rom_t *chip8_romcache_load(chip8_romcache_t *cache, const char *path, unsigned char mode)
+{
+	const chip8_rom_t *r = NULL;
+#ifdef _WIN32
+	// map the file read-only
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) return NULL;
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return NULL;
+	}
+	size_t len = size.QuadPart;
+	if(!len) r = chip8_romcache_add(cache, (const unsigned char*)"", 0, mode);
+	else if(len <= chip8_memsize(mode) - 0x200)
+	{
+		HANDLE map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(map != NULL)
+		{
+			const unsigned char *rom = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			if(rom != NULL)
+			{
+				r = chip8_romcache_add(cache, rom, len, mode);
+				UnmapViewOfFile(rom);
+			}
+			CloseHandle(map);
+		}
+	}
+	CloseHandle(file);
+#else
+	// map the file read-only
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) return NULL;
+	struct stat st;
+	if(fstat(fd, &st) || !S_ISREG(st.st_mode))
+	{
+		close(fd);
+		return NULL;
+	}
+	size_t len = st.st_size;
+	if(!len) r = chip8_romcache_add(cache, (const unsigned char*)"", 0, mode);
+	else if(len <= chip8_memsize(mode) - 0x200)
+	{
+		const unsigned char *rom = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(rom != MAP_FAILED)
+		{
+			r = chip8_romcache_add(cache, rom, len, mode);
+			munmap((void*)rom, len);
+		}
+	}
+	close(fd);
+#endif
+	return r;
+}
+
+// reset a machine and load a cached rom
+void chip8_reset(chip8_t *c, const chip8_rom_t *rom)
+{
+	chip8_setmode(c, rom->mode);
+	chip8_init(c);
+	memcpy(c->memory, rom->image, rom->size);
+	memset(c->written, 0xFF, sizeof(c->written));
+}
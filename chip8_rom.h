@@ -0,0 +1,37 @@
+/******************************************************************************
+chip8_rom.h
+CHIP-8 rom cache: roms loaded once and shared by any number of machines.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// a loaded rom, read-only once returned so machines on any thread can share it
+typedef struct chip8_rom_t
+{
+	unsigned long long hash; // FNV-1a hash of the rom contents
+	size_t len; // rom size
+	unsigned char mode; // machine variant the image is built for
+	size_t size; // image size, the memory size of the variant
+	unsigned char *image; // pristine memory: fontsets and rom
+} chip8_rom_t;
+
+// roms by contents
+typedef struct chip8_romcache_t chip8_romcache_t;
+
+// create an empty cache, returns NULL if out of memory
+chip8_romcache_t *chip8_romcache_create(void);
+
+// release a cache and all its roms
+void chip8_romcache_destroy(chip8_romcache_t *cache);
+
+// add a rom image from a buffer, a rom with the same contents and variant is
+// shared. returns NULL if it doesn't fit in memory or out of memory.
+// adding is not thread safe, fill the cache before machines start using it.
+const chip8_rom_t *chip8_romcache_add(chip8_romcache_t *cache, const unsigned char *rom, size_t len, unsigned char mode);
+
+// add a rom file, mapped into memory instead of read into a buffer
+// returns NULL if it can't be opened, doesn't fit or out of memory
+const chip8_rom_t *chip8_romcache_load(chip8_romcache_t *cache, const char *path, unsigned char mode);
+
+// reset a machine and load a cached rom with one copy of its image
+void chip8_reset(chip8_t *c, const chip8_rom_t *rom);
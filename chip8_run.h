@@ -0,0 +1,590 @@
+/******************************************************************************
+chip8_run.h
+CHIP-8 predecoded interpreter, included by chip8.c once per variant.
+
+Every combination of the screen wrapping and Cowgod-syntax quirks gets its
+own copy of the engine, named CHIP8_RUN, with the quirks fixed to RUN_WRAP
+and RUN_COWGOD. The quirk tests in the handlers and in the inlined sprite
+drawing then fold away, so no variant tests a flag while it runs. The
+handlers use computed goto, which the compiler can't inline or clone, hence
+the include. With RUN_UNTIL defined the variant takes an address map and
+stops early as chip8_run_until describes, for the basic block compiler. With
+RUN_TRACE defined it records every instruction in c->trace, if there is one,
+and runs spins in full so none go missing.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// emulate n cpu cycles with predecoded instructions
+// every 2-byte slot of memory is decoded once into c->decoded and executed
+// by jumping straight from handler to handler (computed goto). memory writes
+// go through chip8_write, which drops the slot so modified code is decoded
+// again. results are identical to calling chip8_cycle n times.
+//
+// keys and timers can't change during a call, so a ROM waiting for them spins
+// in a loop that does the same thing every time around: a short backward
+// 1NNN that arrives with the same V and I as last time and only runs
+// instructions without side effects in between, or FX0A without a key. the
+// rest of such a spin is skipped in one go.
+#ifdef RUN_UNTIL
+static bool CHIP8_RUN(chip8_t *c, unsigned int n, const unsigned char *until)
+#else
+static bool CHIP8_RUN(chip8_t *c, unsigned int n)
+#endif
+{
+	// quirks of this variant
+	const bool screen_wrap = RUN_WRAP, cowgod = RUN_COWGOD;
+	
+	// handler addresses, in OP_ order
+	static const void *const handlers[] =
+	{
+		&&op_decode, &&op_00E0, &&op_00EE, &&op_1NNN, &&op_2NNN, &&op_3XNN, &&op_4XNN, &&op_5XY0,
+		&&op_6XNN, &&op_7XNN, &&op_8XY0, &&op_8XY1, &&op_8XY2, &&op_8XY3, &&op_8XY4, &&op_8XY5,
+		&&op_8XY6, &&op_8XY7, &&op_8XYE, &&op_9XY0, &&op_ANNN, &&op_BNNN, &&op_CXNN, &&op_DXYN,
+		&&op_EX9E, &&op_EXA1, &&op_FX07, &&op_FX0A, &&op_FX15, &&op_FX18, &&op_FX1E, &&op_FX29,
+		&&op_FX33, &&op_FX55, &&op_FX65, &&op_00CN, &&op_00DN, &&op_00FB, &&op_00FC, &&op_00FD,
+		&&op_00FE, &&op_00FF, &&op_5XY2, &&op_5XY3, &&op_F000, &&op_F002, &&op_FN01, &&op_FX30,
+		&&op_FX3A, &&op_FX75, &&op_FX85, &&op_unknown
+	};
+	
+	unsigned char *V = c->V;
+	unsigned short pc = c->pc;
+	unsigned short mask = chip8_mask(c);
+	bool xo = c->mode == CHIP8_MODE_XOCHIP;
+	unsigned int left = n;
+	bool draw = false;
+	chip8_op_t *op = NULL;
+	chip8_op_t odd; // instructions outside the predecoded slots
+	unsigned short spin_pc = 0xFFFF, busy_pc = 0xFFFF; // backward jump seen last, known not to spin
+	unsigned long long spin_V[2] = {0}; // V when arriving there
+	unsigned short spin_I = 0; // I when arriving there
+	unsigned long long ticks = 0, next_tick = 0; // ticks passed, cycle count of the next one
+	
+	// with an address map: stop before an address the map doesn't let run,
+	// or after a write to an address it marks, but never before the first
+	#ifdef RUN_UNTIL
+	bool wrote = false; // an instruction wrote to a CHIP8_UNTIL_CODE address
+	#define STOP() ((wrote || !(until[pc & 0xFFF] & CHIP8_UNTIL_RUN)) && left != n)
+	#define WROTE(addr) wrote |= until[(addr) & 0xFFF] >> 1 & 1
+	#else
+	#define STOP() false
+	#define WROTE(addr)
+	#endif
+	
+	// with a trace: a record per instruction, its registers changed taken from
+	// the decoded instruction and finished with Vx and VF before the next one
+	#ifdef RUN_TRACE
+	const bool spins = false;
+	chip8_trace_t *trace = c->trace;
+	chip8_record_t record;
+	bool recording = false; // record waits for Vx and VF
+	unsigned char record_x = 0;
+	#define TRACE_BEGIN() if(trace) \
+		{ \
+			if(!op->op) chip8_decode(op, c->memory[pc & mask] << 8 | c->memory[(pc + 1) & mask], c->mode); \
+			record.cycle = CYCLES(); \
+			record.pc = pc; \
+			record.opcode = op->opcode; \
+			record.I = c->I; \
+			record.changed = chip8_changed(op, cowgod); \
+			record.sp = c->sp; \
+			record.quirks = cowgod | screen_wrap << 1 | c->mode << 2; \
+			record_x = op->x; \
+			recording = true; \
+		}
+	#define TRACE_END() if(recording) \
+		{ \
+			record.value = V[record_x]; \
+			record.flag = V[0xF]; \
+			chip8_trace_add(trace, &record); \
+			recording = false; \
+		}
+	#else
+	const bool spins = true;
+	#define TRACE_BEGIN()
+	#define TRACE_END()
+	#endif
+	
+	// fetch the predecoded instruction at pc and jump to its handler
+	// odd addresses and XO-CHIP memory above 4KB are decoded every time
+	#define DISPATCH() \
+		TRACE_END(); \
+		if(!left || STOP()) goto done; \
+		left--; \
+		if(pc & mask & 0xF001) { op = &odd; odd.op = OP_DECODE; } \
+		else op = &c->decoded[(pc & 0xFFF) >> 1]; \
+		COUNT(); \
+		TRACE_BEGIN(); \
+		goto *handlers[op->op]
+	
+	// count the instruction in the profile, decoding it early
+	#ifdef CHIP8_PROFILE
+	#define COUNT() if(c->profile) \
+		{ \
+			if(!op->op) chip8_decode(op, c->memory[pc & mask] << 8 | c->memory[(pc + 1) & mask], c->mode); \
+			c->profile->ops[op->op]++; \
+			c->profile->pc[pc & 0xFFF]++; \
+		}
+	#else
+	#define COUNT()
+	#endif
+	
+	// bytes a taken skip moves forward
+	#define SKIP() (xo ? chip8_skip(c, pc) : 4)
+	
+	// instructions run before the current one, and the ticks passed by then
+	#define CYCLES() (c->cycles + (n - left) - 1)
+	#define TICKS() (CYCLES() < next_tick ? ticks : (ticks = chip8_nexttick(c, CYCLES(), &next_tick)))
+	
+	DISPATCH();
+	
+	// slot not decoded yet
+	op_decode:
+		chip8_decode(op, c->memory[pc & mask] << 8 | c->memory[(pc + 1) & mask], c->mode);
+		goto *handlers[op->op];
+	
+	// 00E0 disp_clear
+	op_00E0:
+		chip8_clear(c);
+		draw = true;
+		pc += 2;
+		DISPATCH();
+	
+	// 00EE return
+	op_00EE:
+		c->sp--;
+		pc = c->stack[c->sp & 0xF];
+		DISPATCH();
+	
+	// 1NNN goto NNN
+	op_1NNN:
+		if(spins && op->nnn <= pc && pc - op->nnn < 32 && pc != busy_pc)
+		{
+			// same registers as one time around ago: skip all whole loops left
+			unsigned long long v[2];
+			memcpy(v, V, sizeof(v));
+			if(pc == spin_pc && v[0] == spin_V[0] && v[1] == spin_V[1] && c->I == spin_I)
+			{
+				unsigned char delay = c->delay_end > TICKS() ? c->delay_end - ticks : 0;
+				unsigned int loop = chip8_spin(c, op->nnn, pc, delay, cowgod);
+				if(loop)
+				{
+					// while the delay timer runs, only up to its next tick
+					unsigned long long skip = left;
+					if(delay && next_tick - CYCLES() < skip) skip = next_tick - CYCLES();
+					left -= skip - skip % loop;
+					PROFILE({ c->profile->skipped += skip - skip % loop; c->profile->pc[pc & 0xFFF] += skip - skip % loop; });
+				}
+				else busy_pc = pc;
+			}
+			spin_pc = pc;
+			spin_V[0] = v[0];
+			spin_V[1] = v[1];
+			spin_I = c->I;
+		}
+		pc = op->nnn;
+		DISPATCH();
+	
+	// 2NNN call subroutine NNN
+	op_2NNN:
+		c->stack[c->sp & 0xF] = pc + 2;
+		c->sp++;
+		pc = op->nnn;
+		DISPATCH();
+	
+	// 3XNN skip if(Vx==NN)
+	op_3XNN:
+		pc += V[op->x] == op->nn ? SKIP() : 2;
+		DISPATCH();
+	
+	// 4XNN skip if(Vx!=NN)
+	op_4XNN:
+		pc += V[op->x] != op->nn ? SKIP() : 2;
+		DISPATCH();
+	
+	// 5XY0 skip if(Vx==Vy)
+	op_5XY0:
+		pc += V[op->x] == V[op->y] ? SKIP() : 2;
+		DISPATCH();
+	
+	// 6XNN Vx = NN
+	op_6XNN:
+		V[op->x] = op->nn;
+		pc += 2;
+		DISPATCH();
+	
+	// 7XNN Vx += NN
+	op_7XNN:
+		V[op->x] += op->nn;
+		pc += 2;
+		DISPATCH();
+	
+	// 8XY0 Vx=Vy
+	op_8XY0:
+		V[op->x] = V[op->y];
+		pc += 2;
+		DISPATCH();
+	
+	// 8XY1 Vx=Vx|Vy
+	op_8XY1:
+		V[op->x] |= V[op->y];
+		pc += 2;
+		DISPATCH();
+	
+	// 8XY2 Vx=Vx&Vy
+	op_8XY2:
+		V[op->x] &= V[op->y];
+		pc += 2;
+		DISPATCH();
+	
+	// 8XY3 Vx=Vx^Vy
+	op_8XY3:
+		V[op->x] ^= V[op->y];
+		pc += 2;
+		DISPATCH();
+	
+	// 8XY4 Vx += Vy, VF = carry
+	op_8XY4:
+	{
+		unsigned char x = op->x, y = op->y;
+		unsigned char carry = V[x] + V[y] > 255;
+		V[0xF] = carry;
+		V[x] += V[y];
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// 8XY5 Vx -= Vy, VF = not borrow
+	op_8XY5:
+	{
+		unsigned char x = op->x, y = op->y;
+		unsigned char flag = V[x] >= V[y];
+		V[0xF] = flag;
+		V[x] -= V[y];
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// 8XY6 Vx=Vy=Vy>>1, VF = shifted out bit
+	op_8XY6:
+	{
+		unsigned char x = op->x, y = op->y;
+		if(cowgod)
+		{
+			V[0xF] = V[x] & 1;
+			V[x] = V[x] >> 1;
+		}
+		else
+		{
+			V[0xF] = V[y] & 1;
+			V[y] = V[y] >> 1;
+			V[x] = V[y];
+		}
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// 8XY7 Vx=Vy-Vx, VF = not borrow
+	op_8XY7:
+	{
+		unsigned char x = op->x, y = op->y;
+		unsigned char flag = V[x] <= V[y];
+		V[0xF] = flag;
+		V[x] = V[y] - V[x];
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// 8XYE Vx=Vy=Vy<<1, VF = shifted out bit
+	op_8XYE:
+	{
+		unsigned char x = op->x, y = op->y;
+		if(cowgod)
+		{
+			V[0xF] = (V[x] & 128) >> 7;
+			V[x] = V[x] << 1;
+		}
+		else
+		{
+			V[0xF] = (V[y] & 128) >> 7;
+			V[y] = V[y] << 1;
+			V[x] = V[y];
+		}
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// 9XY0 skip if(Vx!=Vy)
+	op_9XY0:
+		pc += V[op->x] != V[op->y] ? SKIP() : 2;
+		DISPATCH();
+	
+	// ANNN I = NNN
+	op_ANNN:
+		c->I = op->nnn;
+		pc += 2;
+		DISPATCH();
+	
+	// BNNN PC=V0+NNN
+	op_BNNN:
+		pc = op->nnn + V[0];
+		DISPATCH();
+	
+	// CXNN Vx=rand()&NN
+	op_CXNN:
+		V[op->x] = (chip8_rand(c) % 256) & op->nn;
+		pc += 2;
+		DISPATCH();
+	
+	// DXYN draw(Vx,Vy,N)
+	op_DXYN:
+		chip8_draw(c, V[op->x], V[op->y], op->nn & 0x0F, screen_wrap);
+		PROFILE(chip8_profile_draw(c, op->nn & 0x0F));
+		draw = true;
+		pc += 2;
+		DISPATCH();
+	
+	// EX9E if(key()==Vx)
+	op_EX9E:
+		pc += c->key[V[op->x] & 0xF] ? SKIP() : 2;
+		DISPATCH();
+	
+	// EXA1 if(key()!=Vx)
+	op_EXA1:
+		pc += !c->key[V[op->x] & 0xF] ? SKIP() : 2;
+		DISPATCH();
+	
+	// FX07 Vx = get_delay()
+	op_FX07:
+		V[op->x] = c->delay_end > TICKS() ? c->delay_end - ticks : 0;
+		pc += 2;
+		DISPATCH();
+	
+	// FX0A Vx = get_key(), waits for a key press and release
+	op_FX0A:
+		for(int i = 0; i < 16; i++)
+		{
+			if(c->key[i] && c->keyflag == 16) c->keyflag = i;
+		}
+		if(c->keyflag != 16 && !c->key[c->keyflag])
+		{
+			V[op->x] = c->keyflag;
+			c->keyflag = 16;
+			pc += 2;
+		}
+		else left = 0; // keeps waiting until the keys change
+		DISPATCH();
+	
+	// FX15 delay_timer(Vx)
+	op_FX15:
+		c->delay_end = TICKS() + V[op->x];
+		pc += 2;
+		DISPATCH();
+	
+	// FX18 sound_timer(Vx)
+	op_FX18:
+		if(c->sound_end <= TICKS()) c->sound_cycle = CYCLES();
+		c->sound_end = ticks + V[op->x];
+		pc += 2;
+		DISPATCH();
+	
+	// FX1E I +=Vx
+	op_FX1E:
+		c->I += V[op->x];
+		pc += 2;
+		DISPATCH();
+	
+	// FX29 I=sprite_addr[Vx]
+	op_FX29:
+		c->I = 0x50 + (V[op->x] * 5);
+		pc += 2;
+		DISPATCH();
+	
+	// FX33 set_BCD(Vx)
+	op_FX33:
+	{
+		unsigned char value = V[op->x];
+		chip8_write(c, c->I, value / 100);
+		chip8_write(c, c->I+1, (value / 10) % 10);
+		chip8_write(c, c->I+2, value % 10);
+		for(int i = 0; i < 3; i++) WROTE(c->I+i);
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// FX55 reg_dump(Vx,&I)
+	op_FX55:
+	{
+		unsigned char x = op->x;
+		for(int i = 0; i <= x; i++)
+		{
+			chip8_write(c, c->I+i, V[i]);
+			WROTE(c->I+i);
+		}
+		if(!cowgod) c->I += x + 1;
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// FX65 reg_load(Vx,&I)
+	op_FX65:
+	{
+		unsigned char x = op->x;
+		for(int i = 0; i <= x; i++) V[i] = c->memory[(c->I+i) & mask];
+		if(!cowgod) c->I += x + 1;
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// 00CN scroll_down(N)
+	op_00CN:
+		chip8_scrolly(c, op->nn & 0x0F);
+		draw = true;
+		pc += 2;
+		DISPATCH();
+	
+	// 00DN scroll_up(N)
+	op_00DN:
+		chip8_scrolly(c, -(op->nn & 0x0F));
+		draw = true;
+		pc += 2;
+		DISPATCH();
+	
+	// 00FB scroll_right()
+	op_00FB:
+		chip8_scrollx(c, false);
+		draw = true;
+		pc += 2;
+		DISPATCH();
+	
+	// 00FC scroll_left()
+	op_00FC:
+		chip8_scrollx(c, true);
+		draw = true;
+		pc += 2;
+		DISPATCH();
+	
+	// 00FD exit(), stays here for good
+	op_00FD:
+		left = 0;
+		DISPATCH();
+	
+	// 00FE lores()
+	op_00FE:
+		chip8_resolution(c, false);
+		draw = true;
+		pc += 2;
+		DISPATCH();
+	
+	// 00FF hires()
+	op_00FF:
+		chip8_resolution(c, true);
+		draw = true;
+		pc += 2;
+		DISPATCH();
+	
+	// 5XY2 reg_dump(Vx..Vy,&I)
+	op_5XY2:
+	{
+		int x = op->x, y = op->y, step = x <= y ? 1 : -1;
+		for(int i = 0; i <= abs(x - y); i++)
+		{
+			chip8_write(c, c->I+i, V[x + i*step]);
+			WROTE(c->I+i);
+		}
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// 5XY3 reg_load(Vx..Vy,&I)
+	op_5XY3:
+	{
+		int x = op->x, y = op->y, step = x <= y ? 1 : -1;
+		for(int i = 0; i <= abs(x - y); i++) V[x + i*step] = c->memory[(c->I+i) & mask];
+		pc += 2;
+		DISPATCH();
+	}
+	
+	// F000 NNNN I = NNNN
+	op_F000:
+		c->I = c->memory[(unsigned short)(pc + 2)] << 8 | c->memory[(unsigned short)(pc + 3)];
+		pc += 4;
+		DISPATCH();
+	
+	// F002 audio_pattern(&I)
+	op_F002:
+		for(int i = 0; i < 16; i++) c->pattern[i] = c->memory[(c->I+i) & mask];
+		pc += 2;
+		DISPATCH();
+	
+	// FN01 plane(N)
+	op_FN01:
+		c->planes = op->x & 3;
+		pc += 2;
+		DISPATCH();
+	
+	// FX30 I=bigsprite_addr[Vx]
+	op_FX30:
+		c->I = 0xA0 + (V[op->x] & 0xF) * 10;
+		pc += 2;
+		DISPATCH();
+	
+	// FX3A pitch(Vx)
+	op_FX3A:
+		c->pitch = V[op->x];
+		pc += 2;
+		DISPATCH();
+	
+	// FX75 flags_dump(Vx)
+	op_FX75:
+		memcpy(c->flags, V, op->x + 1);
+		pc += 2;
+		DISPATCH();
+	
+	// FX85 flags_load(Vx)
+	op_FX85:
+		memcpy(V, c->flags, op->x + 1);
+		pc += 2;
+		DISPATCH();
+	
+	// unknown opcode, pc is not advanced
+	op_unknown:
+		c->pc = pc;
+		chip8_unknown(c, op->opcode);
+		#ifdef RUN_TRACE
+		// keep the trace leading up to the first unknown opcode it recorded
+		if(trace && !trace->faulted)
+		{
+			TRACE_END();
+			trace->faulted = true;
+			unsigned long long cycles = c->cycles;
+			c->cycles += n - left;
+			chip8_trace_dump(trace, c, CHIP8_TRACE_FILE);
+			c->cycles = cycles;
+		}
+		#endif
+		DISPATCH();
+	
+	#undef DISPATCH
+	#undef STOP
+	#undef WROTE
+	#undef TRACE_BEGIN
+	#undef TRACE_END
+	#undef COUNT
+	#undef SKIP
+	#undef CYCLES
+	#undef TICKS
+	
+	// write back state
+	done:
+	c->pc = pc;
+	c->cycles += n - left;
+	if(op) c->opcode = op->opcode;
+	return draw;
+}
+
+#undef CHIP8_RUN
+#undef RUN_WRAP
+#undef RUN_COWGOD
+#undef RUN_UNTIL
+#undef RUN_TRACE
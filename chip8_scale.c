@@ -0,0 +1,228 @@
+/******************************************************************************
+chip8_scale.c
+CHIP-8 screen upscaler: draws the screen as a pixel-art image at a whole
+number of pixels per CHIP-8 pixel, on the CPU.
+
+The screen is read once into a small image of palette indices. Scale2x or
+Scale3x turn each row of it into 2 or 3 rows of sub-pixels, and each of
+those rows is drawn once into a line of colors, runs of the same color
+filled with wide stores. All image rows of a sub-pixel row are that line,
+so the rest of the work is copying lines, with SSE2/AVX2 stores that bypass
+the cache when the image is too big for it. A whole 4K image is then about
+as fast as memory takes 30MB, so against the screen shown before only the
+rows that changed are drawn again.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#include "chip8_scale.h"
+
+// images larger than this are written around the cache
+#define SCALE_STREAM (1 << 20)
+
+// sub-pixels per pixel and image pixels per sub-pixel
+static void scale_layout(bool hires, unsigned int factor, unsigned int filter, unsigned int *sub, unsigned int *block)
+{
+	unsigned int size = hires ? factor/2 : factor; // image pixels per pixel
+	if(size < 1) size = 1;
+	*sub = (filter & 3) == CHIP8_SCALE_3X ? 3 : (filter & 3) == CHIP8_SCALE_2X ? 2 : 1;
+	if(size < *sub) *sub = 1;
+	*block = size / *sub;
+}
+
+// size of the image of a screen
+void chip8_scale_size(bool hires, unsigned int factor, unsigned int filter, unsigned int *width, unsigned int *height)
+{
+	unsigned int sub, block;
+	scale_layout(hires, factor, filter, &sub, &block);
+	*width = (hires ? 128 : 64)*sub*block;
+	*height = (hires ? 64 : 32)*sub*block;
+}
+
+// fill n pixels with a color
+static inline void scale_fill(unsigned int *dst, unsigned int color, unsigned int n)
+{
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	__m256i v = _mm256_set1_epi32(color);
+	for(; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i*)(dst + i), v);
+#elif defined(__SSE2__)
+	__m128i v = _mm_set1_epi32(color);
+	for(; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(dst + i), v);
+#endif
+	for(; i < n; i++) dst[i] = color;
+}
+
+// n pixels at half brightness, alpha kept
+static void scale_darken(unsigned int *dst, const unsigned int *src, unsigned int n)
+{
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	__m256i rgb = _mm256_set1_epi32(0x7F7F7F), alpha = _mm256_set1_epi32(0xFF000000);
+	for(; i + 8 <= n; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 1), rgb), _mm256_and_si256(v, alpha));
+		_mm256_storeu_si256((__m256i*)(dst + i), v);
+	}
+#elif defined(__SSE2__)
+	__m128i rgb = _mm_set1_epi32(0x7F7F7F), alpha = _mm_set1_epi32(0xFF000000);
+	for(; i + 4 <= n; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		v = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 1), rgb), _mm_and_si128(v, alpha));
+		_mm_storeu_si128((__m128i*)(dst + i), v);
+	}
+#endif
+	for(; i < n; i++) dst[i] = (src[i] >> 1 & 0x7F7F7F) | (src[i] & 0xFF000000);
+}
+
+// copy a line of n pixels into the image, around the cache if stream
+static inline void scale_copy(unsigned int *dst, const unsigned int *src, unsigned int n, bool stream)
+{
+	if(!stream)
+	{
+		memcpy(dst, src, n*sizeof(unsigned int));
+		return;
+	}
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	for(; i < n && (size_t)(dst + i) & 31; i++) dst[i] = src[i];
+	for(; i + 8 <= n; i += 8) _mm256_stream_si256((__m256i*)(dst + i), _mm256_loadu_si256((const __m256i*)(src + i)));
+#elif defined(__SSE2__)
+	for(; i < n && (size_t)(dst + i) & 15; i++) dst[i] = src[i];
+	for(; i + 4 <= n; i += 4) _mm_stream_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+#endif
+	for(; i < n; i++) dst[i] = src[i];
+}
+
+// Scale2x of a row: 2 rows of 2w sub-pixels from the pixel E and its
+// neighbours B above, D left, F right and H below
+static void scale_2x(unsigned char out[3][384], const unsigned char *up, const unsigned char *row, const unsigned char *down, int w)
+{
+	for(int x = 0; x < w; x++)
+	{
+		unsigned char B = up[x], D = row[x - 1], E = row[x], F = row[x + 1], H = down[x];
+		bool edge = B != H && D != F;
+		out[0][2*x] = edge && D == B ? D : E;
+		out[0][2*x + 1] = edge && B == F ? F : E;
+		out[1][2*x] = edge && D == H ? D : E;
+		out[1][2*x + 1] = edge && H == F ? F : E;
+	}
+}
+
+// Scale3x of a row: 3 rows of 3w sub-pixels from the pixel E and its
+// neighbours A B C above, D F beside and G H I below
+static void scale_3x(unsigned char out[3][384], const unsigned char *up, const unsigned char *row, const unsigned char *down, int w)
+{
+	for(int x = 0; x < w; x++)
+	{
+		unsigned char A = up[x - 1], B = up[x], C = up[x + 1];
+		unsigned char D = row[x - 1], E = row[x], F = row[x + 1];
+		unsigned char G = down[x - 1], H = down[x], I = down[x + 1];
+		unsigned char *o0 = &out[0][3*x], *o1 = &out[1][3*x], *o2 = &out[2][3*x];
+		o0[0] = o0[1] = o0[2] = o1[0] = o1[1] = o1[2] = o2[0] = o2[1] = o2[2] = E;
+		if(B == H || D == F) continue;
+		if(D == B) o0[0] = D;
+		if((D == B && E != C) || (B == F && E != A)) o0[1] = B;
+		if(B == F) o0[2] = F;
+		if((D == B && E != G) || (D == H && E != A)) o1[0] = D;
+		if((B == F && E != I) || (H == F && E != C)) o1[2] = F;
+		if(D == H) o2[0] = D;
+		if((D == H && E != I) || (H == F && E != G)) o2[1] = H;
+		if(H == F) o2[2] = F;
+	}
+}
+
+// draw a screen upscaled
+unsigned int chip8_scale(unsigned int *pixels, size_t pitch, const unsigned long long *screen, const unsigned long long *previous, bool hires, unsigned int factor, unsigned int filter, const unsigned int palette[4], unsigned int *top)
+{
+	int w = hires ? 128 : 64, h = hires ? 64 : 32;
+	unsigned int sub, block, width, height;
+	scale_layout(hires, factor, filter, &sub, &block);
+	chip8_scale_size(hires, factor, filter, &width, &height);
+
+	// rows that changed, and with a filter the rows next to them
+	int first = 0, last = h - 1;
+	if(previous)
+	{
+		while(first < h && screen[2*first] == previous[2*first] && screen[2*first + 1] == previous[2*first + 1] &&
+			screen[128 + 2*first] == previous[128 + 2*first] && screen[129 + 2*first] == previous[129 + 2*first]) first++;
+		while(last > first && screen[2*last] == previous[2*last] && screen[2*last + 1] == previous[2*last + 1] &&
+			screen[128 + 2*last] == previous[128 + 2*last] && screen[129 + 2*last] == previous[129 + 2*last]) last--;
+		if(first == h) return 0;
+		if(sub > 1)
+		{
+			if(first > 0) first--;
+			if(last < h - 1) last++;
+		}
+	}
+	if(top) *top = first*sub*block;
+	unsigned int rows = (last + 1 - first)*sub*block;
+	bool stream = (size_t)rows*pitch > SCALE_STREAM;
+
+	// scanlines: the bottom quarter of the rows of each pixel
+	unsigned int size = sub*block;
+	unsigned int dark = filter & CHIP8_SCALE_SCANLINES && size > 1 ? size - (size + 3)/4 : size;
+
+	// palette indices with a border of copies of the edge pixels
+	unsigned char index[66][130];
+	for(int y = 0; y < h; y++)
+	{
+		for(int x = 0; x < w; x++)
+		{
+			int word = y*2 + (x >> 6), shift = 63 - (x & 63);
+			index[y + 1][x + 1] = (screen[word] >> shift & 1) | (screen[128 + word] >> shift & 1) << 1;
+		}
+		index[y + 1][0] = index[y + 1][1];
+		index[y + 1][w + 1] = index[y + 1][w];
+	}
+	memcpy(index[0], index[1], w + 2);
+	memcpy(index[h + 1], index[h], w + 2);
+
+	// one line of colors and its scanline
+	unsigned int *line = malloc(2*width*sizeof(unsigned int));
+	if(line == NULL) return 0;
+	unsigned int *dim = line + width;
+
+	for(int y = first; y <= last; y++)
+	{
+		// sub-pixel rows of this row
+		unsigned char subrows[3][384];
+		if(sub == 3) scale_3x(subrows, &index[y][1], &index[y + 1][1], &index[y + 2][1], w);
+		else if(sub == 2) scale_2x(subrows, &index[y][1], &index[y + 1][1], &index[y + 2][1], w);
+		else memcpy(subrows[0], &index[y + 1][1], w);
+
+		for(unsigned int r = 0; r < sub; r++)
+		{
+			// draw the line a run of equal sub-pixels at a time
+			const unsigned char *s = subrows[r];
+			for(unsigned int x = 0, end; x < w*sub; x = end)
+			{
+				for(end = x + 1; end < w*sub && s[end] == s[x]; end++);
+				scale_fill(line + x*block, palette[s[x]], (end - x)*block);
+			}
+			if(dark < size) scale_darken(dim, line, width);
+
+			// copy it to the image rows of the sub-pixel
+			for(unsigned int i = 0; i < block; i++)
+			{
+				unsigned int *dst = (unsigned int*)((unsigned char*)pixels + ((y*sub + r)*block + i)*pitch);
+				scale_copy(dst, r*block + i >= dark ? dim : line, width, stream);
+			}
+		}
+	}
+#ifdef __SSE2__
+	if(stream) _mm_sfence();
+#endif
+	free(line);
+	return rows;
+}
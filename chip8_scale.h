@@ -0,0 +1,30 @@
+/******************************************************************************
+chip8_scale.h
+CHIP-8 screen upscaler: draws the screen as a pixel-art image at a whole
+number of pixels per CHIP-8 pixel, on the CPU.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// filters, one of the first three, scanlines can be added
+#define CHIP8_SCALE_NEAREST 0 // square blocks
+#define CHIP8_SCALE_2X 1 // Scale2x: diagonal edges smoothed to 2x2 sub-pixels
+#define CHIP8_SCALE_3X 2 // Scale3x: diagonal edges smoothed to 3x3 sub-pixels
+#define CHIP8_SCALE_SCANLINES 4 // bottom rows of every pixel row at half brightness
+
+// colors of off, plane 0, plane 1 and both planes in the window
+#define CHIP8_SCALE_PALETTE { 0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555 }
+
+// size of the image of a screen at factor image pixels per pixel of the
+// 64x32 screen, the 128x64 screen at half that. pixels are whole squares and
+// Scale2x/Scale3x need a multiple of 2 or 3 of them, so the image can be
+// a little smaller than 64*factor by 32*factor.
+void chip8_scale_size(bool hires, unsigned int factor, unsigned int filter, unsigned int *width, unsigned int *height);
+
+// draw a screen (2 bitplanes of 64 rows of 2 words, as chip8_t holds it)
+// upscaled into 32-bit pixels, pitch bytes per row. palette holds the colors
+// of: off, plane 0, plane 1, both planes. previous is the screen the image
+// holds, drawn with the same settings, to draw only the rows that differ
+// from it, or NULL to draw everything. returns the number of image rows
+// drawn, starting at row *top if top isn't NULL.
+unsigned int chip8_scale(unsigned int *pixels, size_t pitch, const unsigned long long *screen, const unsigned long long *previous, bool hires, unsigned int factor, unsigned int filter, const unsigned int palette[4], unsigned int *top);
@@ -0,0 +1,82 @@
+/******************************************************************************
+chip8_trace.c
+CHIP-8 execution trace: fixed-size binary records in a ring buffer.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "chip8_trace.h"
+
+// create a trace of 2^bits records
+chip8_trace_t *chip8_trace_create(int bits)
+{
+	chip8_trace_t *t = malloc(sizeof(chip8_trace_t));
+	if(t == NULL) return NULL;
+	t->records = malloc(sizeof(chip8_record_t) << bits);
+	if(t->records == NULL)
+	{
+		free(t);
+		return NULL;
+	}
+	t->mask = (1u << bits) - 1;
+	atomic_init(&t->head, 0);
+	t->faulted = false;
+	return t;
+}
+
+// release a trace
+void chip8_trace_destroy(chip8_trace_t *t)
+{
+	free(t->records);
+	free(t);
+}
+
+// write the trace and the current machine state to a file
+bool chip8_trace_dump(chip8_trace_t *t, const chip8_t *c, const char *file)
+{
+	// copy the ring, then drop whatever the writer may have overwritten meanwhile
+	unsigned long long size = t->mask + 1ULL;
+	unsigned long long head = atomic_load_explicit(&t->head, memory_order_acquire);
+	unsigned long long first = head > size ? head - size : 0;
+	chip8_record_t *copy = malloc(sizeof(chip8_record_t)*size);
+	if(copy == NULL) return 1;
+	for(unsigned long long i = first; i < head; i++) copy[i - first] = t->records[i & t->mask];
+	atomic_thread_fence(memory_order_acquire);
+	unsigned long long now = atomic_load_explicit(&t->head, memory_order_relaxed);
+	unsigned long long skip = now > first + size ? now - size - first : 0;
+	if(skip > head - first) skip = head - first;
+	
+	// header with the machine state
+	chip8_tracefile_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "J8TR", 4);
+	h.count = head - first - skip;
+	h.last = h.count ? copy[skip + h.count - 1].cycle : 0;
+	h.cycle = c->cycles;
+	h.pc = c->pc;
+	h.I = c->I;
+	h.sp = c->sp;
+	memcpy(h.stack, c->stack, sizeof(h.stack));
+	memcpy(h.V, c->V, sizeof(h.V));
+	
+	// write file
+	FILE *fp = fopen(file, "wb");
+	if(fp == NULL)
+	{
+		free(copy);
+		return 1;
+	}
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(copy + skip, sizeof(chip8_record_t), h.count, fp);
+	fclose(fp);
+	free(copy);
+	if(!c->quiet) printf("Trace of %u instructions written to %s\n", h.count, file);
+	return 0;
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+chip8_trace.h
+CHIP-8 execution trace: fixed-size binary records in a ring buffer.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// default trace dump file
+#define CHIP8_TRACE_FILE "Jos8-trace.bin"
+
+// one executed instruction, 16 bytes
+typedef struct chip8_record_t
+{
+	unsigned int cycle; // instruction count, lowest 32 bits
+	unsigned short pc; // program counter before the instruction
+	unsigned short opcode; // executed opcode
+	unsigned short I; // index register before the instruction
+	unsigned short changed; // bit mask of V registers the instruction writes
+	unsigned char sp; // stack pointer before the instruction
+	unsigned char value; // register X after the instruction
+	unsigned char flag; // register VF after the instruction
+	unsigned char quirks; // bit 0 Cowgod-syntax, bit 1 screen wrapping, bits 2-3 machine variant
+} chip8_record_t;
+
+// ring buffer of records
+// there is one writer, the emulation thread. head only ever grows and is
+// published after the record is written, so a reader can tell which part of
+// its copy may have been overwritten meanwhile.
+typedef struct chip8_trace_t
+{
+	_Atomic unsigned long long head; // records written so far
+	unsigned int mask; // ring size - 1
+	chip8_record_t *records; // ring
+	bool faulted; // dumped at an unknown opcode already
+} chip8_trace_t;
+
+// trace dump file header, followed by the records from oldest to newest.
+// the machine state follows the newest record only if cycle is last + 1.
+typedef struct chip8_tracefile_t
+{
+	char magic[4]; // "J8TR"
+	unsigned int count; // number of records
+	unsigned int last; // instruction count of the newest record, lowest 32 bits
+	unsigned int cycle; // instruction count at the time of the dump, lowest 32 bits
+	unsigned short pc; // machine state at the time of the dump
+	unsigned short I;
+	unsigned short sp;
+	unsigned short stack[16];
+	unsigned char V[16];
+} chip8_tracefile_t;
+
+// append a record
+static inline void chip8_trace_add(chip8_trace_t *t, const chip8_record_t *r)
+{
+	unsigned long long head = atomic_load_explicit(&t->head, memory_order_relaxed);
+	t->records[head & t->mask] = *r;
+	atomic_store_explicit(&t->head, head + 1, memory_order_release);
+}
+
+// create a trace of 2^bits records
+chip8_trace_t *chip8_trace_create(int bits);
+
+// release a trace
+void chip8_trace_destroy(chip8_trace_t *t);
+
+// write the trace and the current machine state to a file
+bool chip8_trace_dump(chip8_trace_t *t, const chip8_t *c, const char *file);
@@ -0,0 +1,264 @@
+/******************************************************************************
+libchip8.c
+CHIP-8 library: machines driven by a host program, one batch of instructions
+per call, with framebuffers that can be read in place by other processes.
+
+A step is one call that sets the keys and runs the predecoded interpreter for
+a whole batch, so a host pays the call once per batch instead of once per
+instruction. The screen is handed out as a pointer into the machine. A
+machine sharing its frames copies the screen into its slot of the shared
+region only after a step that changed it, the reading process maps the
+region once and reads the frames where they are.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "chip8.h"
+#include "chip8_rom.h"
+#include "libchip8.h"
+
+// one machine with its rom and quirk settings
+struct chip8_ctx_t
+{
+	chip8_t *c; // machine
+	chip8_romcache_t *cache; // holds the rom
+	const chip8_rom_t *rom; // rom image the machine resets to
+	bool screen_wrap; // DXYN screen wrapping
+	bool cowgod; // Cowgod's 8XY6/8XYE+FX55/FX65 syntax
+	chip8_shm_t *shm; // region the frames are published to, NULL = none
+	unsigned int slot; // slot in shm
+};
+
+// mapped shared region
+struct chip8_shm_t
+{
+	chip8_shmheader_t *header; // start of the mapping
+	chip8_shmframe_t *frames; // frames after the header
+	size_t size; // bytes mapped
+	bool writable; // mapped by its creator
+	char *name; // name to remove on destroy, NULL = anonymous or not the creator
+#ifdef _WIN32
+	HANDLE map; // file mapping
+#endif
+};
+
+// copy the screen to the shared slot
+static void ctx_publish(chip8_ctx_t *ctx)
+{
+	chip8_shmframe_t *f = &ctx->shm->frames[ctx->slot];
+	unsigned long long seq = atomic_load_explicit(&f->seq, memory_order_relaxed);
+	atomic_store_explicit(&f->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	f->cycles = ctx->c->cycles;
+	f->mode = ctx->c->mode;
+	f->hires = ctx->c->hires;
+	memcpy(f->screen, ctx->c->screen, sizeof(f->screen));
+	atomic_store_explicit(&f->seq, seq + 2, memory_order_release);
+}
+
+// create a machine for a rom
+chip8_ctx_t *chip8_ctx_create(const unsigned char *rom, size_t len, unsigned char mode, unsigned long long seed, unsigned int rate)
+{
+	chip8_ctx_t *ctx = calloc(1, sizeof(chip8_ctx_t));
+	if(ctx == NULL) return NULL;
+	ctx->c = calloc(1, sizeof(chip8_t));
+	ctx->cache = chip8_romcache_create();
+	if(ctx->c == NULL || ctx->cache == NULL || (ctx->rom = chip8_romcache_add(ctx->cache, rom, len, mode)) == NULL)
+	{
+		chip8_ctx_destroy(ctx);
+		return NULL;
+	}
+	ctx->c->quiet = true;
+	ctx->c->rate = rate ? rate : 480;
+	ctx->cowgod = true;
+	chip8_ctx_reset(ctx, seed);
+	return ctx;
+}
+
+// release a machine
+void chip8_ctx_destroy(chip8_ctx_t *ctx)
+{
+	if(ctx->cache) chip8_romcache_destroy(ctx->cache);
+	free(ctx->c);
+	free(ctx);
+}
+
+// reset the machine to the start of its rom
+void chip8_ctx_reset(chip8_ctx_t *ctx, unsigned long long seed)
+{
+	chip8_reset(ctx->c, ctx->rom);
+	chip8_seed(ctx->c, seed);
+	if(ctx->shm) ctx_publish(ctx);
+}
+
+// set the quirks
+void chip8_ctx_quirks(chip8_ctx_t *ctx, bool screen_wrap, bool cowgod)
+{
+	ctx->screen_wrap = screen_wrap;
+	ctx->cowgod = cowgod;
+}
+
+// run n instructions with keys held
+bool chip8_step(chip8_ctx_t *ctx, unsigned int n, unsigned short keys)
+{
+	chip8_t *c = ctx->c;
+	for(int k = 0; k < 16; k++) c->key[k] = keys >> k & 1;
+	bool drawn = chip8_run(c, n, ctx->screen_wrap, ctx->cowgod);
+	if(drawn && ctx->shm) ctx_publish(ctx);
+	return drawn;
+}
+
+// framebuffer of the machine
+const unsigned long long *chip8_ctx_screen(const chip8_ctx_t *ctx, bool *hires)
+{
+	if(hires) *hires = ctx->c->hires;
+	return &ctx->c->screen[0][0][0];
+}
+
+// the machine itself
+chip8_t *chip8_ctx_machine(chip8_ctx_t *ctx)
+{
+	return ctx->c;
+}
+
+// publish the machine's frames to a slot of a shared region
+bool chip8_ctx_share(chip8_ctx_t *ctx, chip8_shm_t *shm, unsigned int slot)
+{
+	if(shm && (!shm->writable || slot >= shm->header->slots)) return 1;
+	ctx->shm = shm;
+	ctx->slot = slot;
+	if(shm) ctx_publish(ctx);
+	return 0;
+}
+
+// map size of a region of slots frames
+static size_t shm_size(unsigned int slots)
+{
+	return sizeof(chip8_shmheader_t) + (size_t)slots*sizeof(chip8_shmframe_t);
+}
+
+// create a shared region
+chip8_shm_t *chip8_shm_create(const char *name, unsigned int slots)
+{
+	chip8_shm_t *shm = calloc(1, sizeof(chip8_shm_t));
+	if(shm == NULL) return NULL;
+	shm->size = shm_size(slots);
+	void *p = NULL;
+#ifdef _WIN32
+	shm->map = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)shm->size >> 32), (DWORD)shm->size, name);
+	if(shm->map != NULL) p = MapViewOfFile(shm->map, FILE_MAP_ALL_ACCESS, 0, 0, shm->size);
+	if(p == NULL)
+	{
+		if(shm->map != NULL) CloseHandle(shm->map);
+		free(shm);
+		return NULL;
+	}
+#else
+	if(name == NULL) p = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	else
+	{
+		int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if(fd >= 0)
+		{
+			if(!ftruncate(fd, shm->size)) p = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			if(p == MAP_FAILED) shm_unlink(name);
+		}
+		shm->name = strdup(name);
+	}
+	if(p == NULL || p == MAP_FAILED)
+	{
+		free(shm->name);
+		free(shm);
+		return NULL;
+	}
+#endif
+
+	// the pages start zeroed, a frame with seq 0 was never written
+	shm->header = p;
+	shm->frames = (chip8_shmframe_t*)(shm->header + 1);
+	shm->writable = true;
+	shm->header->version = CHIP8_SHM_VERSION;
+	shm->header->slots = slots;
+	shm->header->size = sizeof(chip8_shmframe_t);
+	atomic_thread_fence(memory_order_release);
+	memcpy(shm->header->magic, CHIP8_SHM_MAGIC, 4);
+	return shm;
+}
+
+// map an existing region read-only
+chip8_shm_t *chip8_shm_open(const char *name)
+{
+	chip8_shm_t *shm = calloc(1, sizeof(chip8_shm_t));
+	if(shm == NULL) return NULL;
+	void *p = NULL;
+#ifdef _WIN32
+	// map it whole, the view size comes from the mapping
+	shm->map = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if(shm->map != NULL) p = MapViewOfFile(shm->map, FILE_MAP_READ, 0, 0, 0);
+	if(p != NULL)
+	{
+		MEMORY_BASIC_INFORMATION info;
+		shm->size = VirtualQuery(p, &info, sizeof(info)) ? info.RegionSize : 0;
+	}
+#else
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd >= 0)
+	{
+		struct stat st;
+		if(!fstat(fd, &st) && (size_t)st.st_size >= sizeof(chip8_shmheader_t))
+		{
+			shm->size = st.st_size;
+			p = mmap(NULL, shm->size, PROT_READ, MAP_SHARED, fd, 0);
+			if(p == MAP_FAILED) p = NULL;
+		}
+		close(fd);
+	}
+#endif
+	shm->header = p;
+
+	// the region must be complete and of this layout
+	if(p == NULL || shm->size < sizeof(chip8_shmheader_t) || memcmp(shm->header->magic, CHIP8_SHM_MAGIC, 4) ||
+		shm->header->version != CHIP8_SHM_VERSION || shm->header->size != sizeof(chip8_shmframe_t) ||
+		shm->size < shm_size(shm->header->slots))
+	{
+		chip8_shm_destroy(shm);
+		return NULL;
+	}
+	shm->frames = (chip8_shmframe_t*)(shm->header + 1);
+	return shm;
+}
+
+// unmap a region
+void chip8_shm_destroy(chip8_shm_t *shm)
+{
+#ifdef _WIN32
+	if(shm->header) UnmapViewOfFile(shm->header);
+	if(shm->map) CloseHandle(shm->map);
+#else
+	if(shm->header) munmap(shm->header, shm->size);
+	if(shm->name) shm_unlink(shm->name);
+#endif
+	free(shm->name);
+	free(shm);
+}
+
+// frame of a slot
+const chip8_shmframe_t *chip8_shm_frame(const chip8_shm_t *shm, unsigned int slot)
+{
+	return &shm->frames[slot];
+}
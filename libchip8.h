@@ -0,0 +1,106 @@
+/******************************************************************************
+libchip8.h
+CHIP-8 library: machines driven by a host program, one batch of instructions
+per call, with framebuffers that can be read in place by other processes.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// one machine with its rom and quirk settings
+typedef struct chip8_ctx_t chip8_ctx_t;
+
+// framebuffers of many machines in one shared memory region
+typedef struct chip8_shm_t chip8_shm_t;
+
+// shared memory region layout: a chip8_shmheader_t, then slots frames of
+// chip8_shmframe_t, all 64-byte aligned
+#define CHIP8_SHM_MAGIC "J8FB"
+#define CHIP8_SHM_VERSION 1
+
+typedef struct chip8_shmheader_t
+{
+	char magic[4]; // CHIP8_SHM_MAGIC
+	unsigned int version; // CHIP8_SHM_VERSION
+	unsigned int slots; // number of frames
+	unsigned int size; // bytes per frame, sizeof(chip8_shmframe_t)
+	unsigned char reserved[48];
+} chip8_shmheader_t;
+
+// the last frame of one machine
+// the machine writes it after every step that changed the screen, as a
+// sequence lock: seq is odd while the frame is being written and goes up by
+// 2 for every frame. a reader takes seq (chip8_shm_begin), reads the frame
+// in place and checks seq didn't change (chip8_shm_end), no locks or system
+// calls on either side.
+typedef struct chip8_shmframe_t
+{
+	_Alignas(64) _Atomic unsigned long long seq; // frame sequence number times 2, odd while written
+	unsigned long long cycles; // instruction count of the machine at this frame
+	unsigned char mode; // machine variant, CHIP8_MODE_*
+	bool hires; // 128x64 screen instead of 64x32
+	unsigned long long screen[2][64][2]; // bitplanes, see chip8_ctx_screen
+} chip8_shmframe_t;
+
+// create a machine for a rom in mode (CHIP8_MODE_*), seeded with seed and
+// running rate instructions per second (0 = 480). returns NULL if the rom
+// doesn't fit or out of memory.
+chip8_ctx_t *chip8_ctx_create(const unsigned char *rom, size_t len, unsigned char mode, unsigned long long seed, unsigned int rate);
+
+// release a machine
+void chip8_ctx_destroy(chip8_ctx_t *ctx);
+
+// reset the machine to the start of its rom with a new seed
+void chip8_ctx_reset(chip8_ctx_t *ctx, unsigned long long seed);
+
+// set the screen wrapping and Cowgod-syntax quirks (default off and on)
+void chip8_ctx_quirks(chip8_ctx_t *ctx, bool screen_wrap, bool cowgod);
+
+// run n instructions with keys held (bit k = key k pressed) in one call.
+// returns 1 if the screen changed.
+bool chip8_step(chip8_ctx_t *ctx, unsigned int n, unsigned short keys);
+
+// framebuffer of the machine, updated in place by chip8_step: 2 bitplanes of
+// 64 rows of 2 words, pixel x of row y in bit 63 - x%64 of word x/64. the
+// 64x32 screen uses the first word of rows 0-31. hires is set to the
+// resolution if not NULL.
+const unsigned long long *chip8_ctx_screen(const chip8_ctx_t *ctx, bool *hires);
+
+// the machine itself, for anything chip8.h offers
+struct chip8_t *chip8_ctx_machine(chip8_ctx_t *ctx);
+
+// publish the machine's frames to a slot of a shared region from now on,
+// shm NULL stops. returns 1 if the slot doesn't exist or the region is read-only.
+bool chip8_ctx_share(chip8_ctx_t *ctx, chip8_shm_t *shm, unsigned int slot);
+
+// create a shared region of slots frames under name ("/name" on POSIX, a
+// kernel object name on Windows), NULL = anonymous, shared with child
+// processes. returns NULL on error.
+chip8_shm_t *chip8_shm_create(const char *name, unsigned int slots);
+
+// map an existing region read-only, for a reading process. returns NULL on error.
+chip8_shm_t *chip8_shm_open(const char *name);
+
+// unmap a region, its creator also removes the name
+void chip8_shm_destroy(chip8_shm_t *shm);
+
+// frame of a slot
+const chip8_shmframe_t *chip8_shm_frame(const chip8_shm_t *shm, unsigned int slot);
+
+// start reading a frame in place, returns its sequence number, odd if it is
+// being written (try again)
+static inline unsigned long long chip8_shm_begin(const chip8_shmframe_t *f)
+{
+	return atomic_load_explicit((_Atomic unsigned long long*)&f->seq, memory_order_acquire);
+}
+
+// finish reading a frame, returns 1 if what was read is a whole frame
+static inline bool chip8_shm_end(const chip8_shmframe_t *f, unsigned long long seq)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return !(seq & 1) && atomic_load_explicit((_Atomic unsigned long long*)&f->seq, memory_order_relaxed) == seq;
+}
@@ -9,17 +9,91 @@ Jos8: a work in progress CHIP-8 emulator using C and SDL2
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
 #include "chip8.h"
+#include "chip8_trace.h"
+#include "chip8_rewind.h"
+#include "chip8_rom.h"
+#include "chip8_input.h"
+#include "chip8_profile.h"
+#include "chip8_audio.h"
+#include "chip8_scale.h"
+#include "chip8_capture.h"
 #include "SDL2/SDL.h"
 
 
 // global variables and settings
-float scale = 10; // scaling of 64x32 CHIP-8 screen
-bool running, paused = false; // running/pause state
-bool debug = false; // debug state
-bool screen_wrap = false; // enable DXYN screen wrapping
-bool cowgod = true; // enable Cowgod's 8XY6/8XYE+FX55/FX65 syntax
-unsigned char xoffset, yoffset = 0; // screen resize offset
+unsigned int scale = 10; // window pixels per 64x32 CHIP-8 pixel, 128x64 is drawn at half that
+unsigned int filter = CHIP8_SCALE_NEAREST; // upscaling filter and scanlines, CHIP8_SCALE_*
+unsigned char mode = CHIP8_MODE_CHIP8; // machine variant
+_Atomic bool running, paused = false; // running/pause state
+_Atomic bool debug = false; // trace recording state
+unsigned int rate = 480; // cpu instructions per second
+bool pattern = false; // play XO-CHIP audio patterns instead of a square wave
+_Atomic bool screen_wrap = false; // enable DXYN screen wrapping
+_Atomic bool cowgod = true; // enable Cowgod's 8XY6/8XYE+FX55/FX65 syntax
+int xoffset, yoffset = 0; // screen offset in window pixels
+chip8_t chip8; // emulated machine
+chip8_rewind_t *history; // rewind history, about 10 minutes
+chip8_romcache_t *roms; // loaded roms
+const chip8_rom_t *image; // rom a reset starts over with
+unsigned long long seed; // CXNN random seed of the session
+chip8_input_t *recording; // input recording of the session
+bool overlay = false; // profile overlay, in CHIP8_PROFILE builds
+chip8_audio_t *audio; // sound samples on their way to the audio device
+chip8_capture_t *capture; // frames on their way to a capture file or encoder, NULL = off
+
+// input from the window thread to the emulation thread
+_Atomic bool fast = false; // fast-forward held
+_Atomic bool rewinding = false; // rewind held
+_Atomic unsigned int commands = 0; // COMMAND_ requests not handled yet
+
+// a change of the CHIP-8 keys
+typedef struct keyevent_t
+{
+	Uint64 time; // host clock time it happened
+	unsigned short keys; // keys held from then on, bit per key
+} keyevent_t;
+
+// key events from the window thread to the emulation thread, a single
+// producer single consumer ring. the emulation thread applies each event at
+// the cycle of the tick its time falls in, so a key reaches the cpu at the
+// point in emulated time it was pressed and a tap shorter than a frame is
+// still seen as a press and a release.
+#define KEYEVENTS 256 // ring size, a power of two
+keyevent_t keyevents[KEYEVENTS]; // ring
+_Atomic unsigned int keyevent_head = 0; // events written
+_Atomic unsigned int keyevent_tail = 0; // events applied
+
+// requests the emulation thread handles between ticks
+enum { COMMAND_RESET = 1, COMMAND_TRACE = 2, COMMAND_RECORDING = 4 };
+
+// a finished frame, handed from the emulation thread to the window thread
+typedef struct frame_t
+{
+	unsigned long long screen[2][64][2]; // bitplanes
+	bool hires; // 128x64 screen
+} frame_t;
+
+// triple buffer of frames: the emulation thread draws into back and swaps it
+// with middle, the window thread swaps middle with front when middle holds a
+// new frame. neither thread ever waits for the other, and the window always
+// shows the newest finished frame.
+#define FRAME_NEW 4 // flag in frame_middle: not shown yet
+frame_t frames[3]; // frame buffers
+_Atomic int frame_middle = 1; // buffer in between and FRAME_NEW
+int frame_back = 0; // buffer of the emulation thread
+int frame_front = 2; // buffer of the window thread
+Uint32 frame_event = (Uint32)-1; // SDL event that wakes the window thread for a new frame
+
+// the front frame upscaled to the window on the CPU as a picture, the texture
+// holds the same pixels and is shown unscaled, so every CHIP-8 pixel is a sharp square
+Uint32 *picture = NULL; // upscaled frame
+size_t picture_pitch; // bytes per picture row
+frame_t shown; // frame the picture holds
+bool picture_valid = false; // picture holds shown, only changed rows are drawn again
 
 // SDL snancode to CHIP-8 keycode conversion
 const int keyconvert[16] = 
@@ -30,128 +104,548 @@ const int keyconvert[16] =
 	SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
 };
 
-// render a full frame
-void render_frame(SDL_Renderer *renderer, unsigned char xo, unsigned char yo)
+// bitplane colors: off, plane 0, plane 1, both (XO-CHIP)
+const Uint32 palette[4] = CHIP8_SCALE_PALETTE;
+
+// mode names for the -m argument, in CHIP8_MODE_ order
+const char *mode_names[3] = { "chip8", "schip", "xochip" };
+
+// filter names for the -f argument, in CHIP8_SCALE_ order
+const char *filter_names[3] = { "nearest", "scale2x", "scale3x" };
+
+// hand the current screen to the window thread (emulation thread)
+void publish_frame(void)
+{
+	memcpy(frames[frame_back].screen, chip8.screen, sizeof(chip8.screen));
+	frames[frame_back].hires = chip8.hires;
+	int middle = atomic_exchange(&frame_middle, frame_back | FRAME_NEW);
+	frame_back = middle & 3;
+
+	// wake the window thread, once until it takes the frame
+	if(!(middle & FRAME_NEW) && frame_event != (Uint32)-1)
+	{
+		SDL_Event event;
+		SDL_zero(event);
+		event.type = frame_event;
+		SDL_PushEvent(&event);
+	}
+}
+
+// take the newest frame if there is one (window thread)
+bool take_frame(void)
+{
+	if(!(atomic_load(&frame_middle) & FRAME_NEW)) return false;
+	frame_front = atomic_exchange(&frame_middle, frame_front) & 3;
+	return true;
+}
+
+// create the texture and picture for the window scale
+SDL_Texture *create_picture(SDL_Renderer *renderer)
 {
-	for(int y = 0; y < 32; y++)
-	{			
-		for(int x = 0; x < 64; x++)
+	free(picture);
+	picture_pitch = 64*scale*sizeof(Uint32);
+	picture = malloc(picture_pitch*32*scale);
+	picture_valid = false;
+	return SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 64*scale, 32*scale);
+}
+
+// upscale a frame into the picture and update the rows of the texture that changed
+void upload_frame(SDL_Texture *texture, const frame_t *f)
+{
+	if(picture == NULL) return;
+	unsigned int width, height, top;
+	chip8_scale_size(f->hires, scale, filter, &width, &height);
+	bool same = picture_valid && shown.hires == f->hires;
+	unsigned int rows = chip8_scale(picture, picture_pitch, &f->screen[0][0][0], same ? &shown.screen[0][0][0] : NULL, f->hires, scale, filter, palette, &top);
+	if(rows)
+	{
+		SDL_Rect r = {0, top, width, rows};
+		SDL_UpdateTexture(texture, &r, (Uint8 *)picture + top*picture_pitch, picture_pitch);
+	}
+	shown = *f;
+	picture_valid = true;
+}
+
+#ifdef CHIP8_PROFILE
+// draw a hex number in the CHIP-8 font, size window pixels per font pixel
+void draw_hex(SDL_Renderer *renderer, int x, int y, unsigned int value, int digits, int size)
+{
+	for(int d = 0; d < digits; d++)
+	{
+		const unsigned char *glyph = &chip8_fontset[5*(value >> 4*(digits - 1 - d) & 0xF)];
+		for(int row = 0; row < 5; row++)
 		{
-			if(screen[x][y]) // white pixel
+			for(int col = 0; col < 4; col++)
 			{
-				SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-				SDL_RenderDrawPoint(renderer, x+xo, y+yo);
+				if(!(glyph[row] & 0x80 >> col)) continue;
+				SDL_Rect r = {x + (5*d + col)*size, y + row*size, size, size};
+				SDL_RenderFillRect(renderer, &r);
 			}
-			else // black pixel
-			{
-				SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-				SDL_RenderDrawPoint(renderer, x+xo, y+yo);
-			}
-		}					
+		}
+	}
+}
+
+// number of bits of a count, a cheap logarithm for brightness
+int bits(unsigned long long v)
+{
+	return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+// profile overlay: a heat map of the 4KB address space (64 addresses per row)
+// with the hottest address next to it, and bars of the instructions (green)
+// and draws (red) of recent frames along the bottom. the counters are read
+// while the emulation thread updates them, a stale count only shows late.
+void render_overlay(SDL_Renderer *renderer)
+{
+	const chip8_profile_t *p = chip8.profile;
+	int cell = scale/5 > 1 ? scale/5 : 1;
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	
+	// heat map, brightness by the logarithm of the count
+	int hot = 0;
+	for(int a = 1; a < 4096; a++) if(p->pc[a] > p->pc[hot]) hot = a;
+	int top = bits(p->pc[hot]);
+	SDL_Rect back = {xoffset, yoffset, 64*cell, 64*cell};
+	SDL_SetRenderDrawColor(renderer, 0, 0, 64, 160);
+	SDL_RenderFillRect(renderer, &back);
+	for(int a = 0; a < 4096; a++)
+	{
+		if(!p->pc[a]) continue;
+		int level = 64 + 191*bits(p->pc[a])/top;
+		SDL_Rect r = {xoffset + (a & 63)*cell, yoffset + (a >> 6)*cell, cell, cell};
+		SDL_SetRenderDrawColor(renderer, 255, level, 0, level);
+		SDL_RenderFillRect(renderer, &r);
+	}
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+	draw_hex(renderer, xoffset + 65*cell, yoffset, hot, 3, cell);
+	
+	// recent frames, scaled to the largest
+	unsigned int frames = p->frames < CHIP8_PROFILE_FRAMES ? p->frames : CHIP8_PROFILE_FRAMES;
+	unsigned int maxops = 1, maxdrawn = 1;
+	for(unsigned int i = 0; i < frames; i++)
+	{
+		if(p->frame_ops[i] > maxops) maxops = p->frame_ops[i];
+		if(p->frame_drawn[i] > maxdrawn) maxdrawn = p->frame_drawn[i];
 	}
+	int w = 64*scale/CHIP8_PROFILE_FRAMES > 1 ? 64*scale/CHIP8_PROFILE_FRAMES : 1;
+	int h = 8*scale, bottom = yoffset + 32*scale;
+	for(unsigned int i = 0; i < frames; i++)
+	{
+		unsigned int f = (p->frames - frames + i) % CHIP8_PROFILE_FRAMES;
+		int ops = (unsigned long long)h*p->frame_ops[f]/maxops;
+		int drawn = (unsigned long long)h*p->frame_drawn[f]/maxdrawn;
+		SDL_Rect bar = {xoffset + i*w, bottom - ops, w, ops};
+		SDL_SetRenderDrawColor(renderer, 0, 255, 0, 128);
+		SDL_RenderFillRect(renderer, &bar);
+		bar = (SDL_Rect){xoffset + i*w, bottom - drawn, w > 2 ? w/2 : w, drawn};
+		SDL_SetRenderDrawColor(renderer, 255, 0, 0, 160);
+		SDL_RenderFillRect(renderer, &bar);
+	}
+}
+#endif
+
+// render a full frame, centered in the window
+void render_frame(SDL_Renderer *renderer, SDL_Texture *texture)
+{
+	unsigned int width, height;
+	chip8_scale_size(shown.hires, scale, filter, &width, &height);
+	SDL_Rect src = {0, 0, width, height};
+	SDL_Rect dest = {xoffset + (64*scale - width)/2, yoffset + (32*scale - height)/2, width, height};
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, texture, &src, &dest);
+#ifdef CHIP8_PROFILE
+	if(overlay && chip8.profile) render_overlay(renderer);
+#endif
 	SDL_RenderPresent(renderer); // update screen
 }
 
+// reset emulation: start the rom over from its cached memory image (emulation thread)
+void reset(void)
+{
+	chip8_reset(&chip8, image);
+	chip8_setrate(&chip8, rate);
+	if(history) chip8_rewind_clear(history);
+	if(recording) chip8_input_reset(recording);
+}
+
+// quirk flags for the input recording
+unsigned char quirks(void)
+{
+	return (screen_wrap ? CHIP8_INPUT_WRAP : 0) | (cowgod ? CHIP8_INPUT_COWGOD : 0);
+}
+
+// queue a CHIP-8 key press or release with the time it happened (window thread)
+void queue_key(const SDL_Event *event)
+{
+	static unsigned short held = 0; // keys held after the last event
+	int k = 0;
+	while(k < 16 && keyconvert[k] != event->key.keysym.scancode) k++;
+	if(k == 16) return;
+	if(event->type == SDL_KEYDOWN) held |= 1 << k;
+	else held &= ~(1 << k);
+	
+	// event timestamps are in milliseconds of SDL_GetTicks
+	Uint64 now = SDL_GetPerformanceCounter();
+	Uint64 ago = (Uint64)(SDL_GetTicks() - event->key.timestamp)*SDL_GetPerformanceFrequency()/1000;
+	unsigned int head = atomic_load_explicit(&keyevent_head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&keyevent_tail, memory_order_acquire) == KEYEVENTS) return; // full, the next one carries all keys
+	keyevents[head % KEYEVENTS].time = ago < now ? now - ago : 0;
+	keyevents[head % KEYEVENTS].keys = held;
+	atomic_store_explicit(&keyevent_head, head + 1, memory_order_release);
+}
+
+// oldest key event not applied yet, NULL if there is none (emulation thread)
+const keyevent_t *next_key(void)
+{
+	unsigned int tail = atomic_load_explicit(&keyevent_tail, memory_order_relaxed);
+	if(tail == atomic_load_explicit(&keyevent_head, memory_order_acquire)) return NULL;
+	return &keyevents[tail % KEYEVENTS];
+}
+
+// apply the oldest key event (emulation thread)
+void apply_key(void)
+{
+	unsigned int tail = atomic_load_explicit(&keyevent_tail, memory_order_relaxed);
+	for(int k = 0; k < 16; k++) chip8.key[k] = keyevents[tail % KEYEVENTS].keys >> k & 1;
+	atomic_store_explicit(&keyevent_tail, tail + 1, memory_order_release);
+	if(recording) chip8_input_keys(recording, &chip8);
+}
+
+// audio device callback: play the samples the emulation thread made
+void play_audio(void *data, Uint8 *stream, int len)
+{
+	chip8_audio_read(data, (short *)stream, len/sizeof(short));
+}
+
 // update SDL window title
 void update_SDL_title(SDL_Window *window)
 {
 	char buf[50] = {0};
 	strcpy(buf, "Jos8");
 	if(paused) strcat (buf, " (paused)");
-	if(debug) strcat (buf, " - debug-output");
+	if(debug) strcat (buf, " - tracing");
 	if(screen_wrap) strcat (buf, " - screen-wrapping");
 	if(cowgod) strcat (buf, " - Cowgod-syntax");
 	SDL_SetWindowTitle(window, buf); 
 }
 
 // update SDL window scale and offset
-void update_SDL_size(SDL_Event event, SDL_Renderer *renderer)
+void update_SDL_size(SDL_Event event, SDL_Renderer *renderer, SDL_Texture **texture)
 {
-	// scale the emulator within bounds of screen
+	// scale the emulator within bounds of screen, by whole pixels
 	if(event.window.data1/64 < event.window.data2/32) scale = event.window.data1/64;
 	else scale = event.window.data2/32;
+	if(scale < 1) scale = 1;
 	
 	// center image
-	xoffset = (int)(event.window.data1 - (scale*64))/2/scale;
-	yoffset = (int)(event.window.data2 - (scale*32))/2/scale;
+	xoffset = (event.window.data1 - (int)scale*64)/2;
+	yoffset = (event.window.data2 - (int)scale*32)/2;
 	
-	// render
-	SDL_RenderSetScale(renderer, scale, scale);
-	render_frame(renderer, xoffset, yoffset);
+	// upscale to the new size and render
+	SDL_DestroyTexture(*texture);
+	*texture = create_picture(renderer);
+	upload_frame(*texture, &frames[frame_front]);
+	render_frame(renderer, *texture);
 }
 
-// main emulator loop
+// emulation thread: runs the cpu and timers at the host clock, publishes
+// finished frames and takes input and requests from the window thread
+int emulate(void *data)
+{
+	(void)data;
+	Uint64 freq = SDL_GetPerformanceFrequency(); // clock ticks per second
+	Uint64 base_time = SDL_GetPerformanceCounter(); // clock time of base_tick
+	Uint64 base_tick = 0, ticks = 0; // emulated 60Hz ticks at base_time and so far
+	unsigned char flags = quirks(); // quirk flags in use
+	
+	while(running)
+	{
+		// requests from the window
+		unsigned int todo = atomic_exchange(&commands, 0);
+		bool draw = false;
+		if(todo & COMMAND_RESET)
+		{
+			reset();
+			draw = true;
+			if(capture) chip8_capture_frame(capture, &chip8);
+		}
+		if(todo & COMMAND_TRACE && chip8.trace && debug) chip8_trace_dump(chip8.trace, &chip8, CHIP8_TRACE_FILE);
+		if(todo & COMMAND_RECORDING && recording) chip8_input_save(recording, &chip8, CHIP8_INPUT_FILE);
+		if(quirks() != flags)
+		{
+			flags = quirks();
+			if(recording) chip8_input_quirks(recording, &chip8, flags);
+		}
+		bool wrap = flags & CHIP8_INPUT_WRAP, syntax = flags & CHIP8_INPUT_COWGOD;
+		
+		// dont emulate while paused, continue from now afterwards
+		if(paused)
+		{
+			while(next_key()) apply_key();
+			if(draw) publish_frame();
+			SDL_Delay(1000/60);
+			base_time = SDL_GetPerformanceCounter();
+			base_tick = ticks;
+			continue;
+		}
+		
+		// emulated time follows the clock, each 60Hz tick runs rate/60 instructions.
+		// fast-forward runs ticks for one frame's worth of host time, then publishes.
+		// the cpu runs on the engine built for the current trace and quirk settings.
+		bool forward = fast;
+		chip8_engine_t engine = chip8_engine(debug, wrap, syntax);
+		Uint64 now = SDL_GetPerformanceCounter();
+		Uint64 due = base_tick + (now - base_time)*60/freq;
+		if(due > ticks + 15) due = ticks + 15; // don't catch up after a stall
+		while(forward ? SDL_GetPerformanceCounter() - now < freq/60 : ticks < due)
+		{
+			// host clock span of this tick
+			Uint64 tick_start = base_time + (ticks - base_tick)*freq/60;
+			Uint64 tick_end = base_time + (ticks + 1 - base_tick)*freq/60;
+			const keyevent_t *e;
+			bool drawn = false; // screen changed in this tick
+			
+			// step back one tick while rewind is held
+			if(rewinding && history)
+			{
+				drawn = chip8_rewind_pop(history, &chip8);
+				if(recording) chip8_input_rewind(recording, &chip8);
+				while((e = next_key()) && e->time < tick_end) apply_key();
+			}
+			else
+			{
+				// run this tick's cpu cycles, key events at the cycle of their
+				// time within the tick. events from before the tick (late or
+				// while fast-forwarding) apply at its start.
+				unsigned int n = (ticks + 1)*rate/60 - ticks*rate/60, done = 0;
+				unsigned long long start = chip8.cycles;
+				while((e = next_key()) && e->time < tick_end)
+				{
+					unsigned int at = e->time > tick_start ? (e->time - tick_start)*n/(tick_end - tick_start) : 0;
+					if(at > done)
+					{
+						drawn |= engine(&chip8, at - done);
+						done = at;
+					}
+					apply_key();
+				}
+				drawn |= engine(&chip8, n - done);
+				
+				// sound of this tick
+				if(audio) chip8_audio_generate(audio, &chip8, start);
+				
+				// record frame
+				if(history) chip8_rewind_push(history, &chip8);
+				
+				// screen checkpoint every second
+				if(recording && ticks % 60 == 59) chip8_input_check(recording, &chip8);
+#ifdef CHIP8_PROFILE
+				if(chip8.profile) chip8_profile_frame(chip8.profile, &chip8);
+#endif
+			}
+			
+			// capture the screen of every tick that changed it
+			if(drawn && capture) chip8_capture_frame(capture, &chip8);
+			draw |= drawn;
+			ticks++;
+		}
+		
+		// after fast-forward or a stall the clock continues from here
+		if(forward || ticks < base_tick + (now - base_time)*60/freq)
+		{
+			base_time = SDL_GetPerformanceCounter();
+			base_tick = ticks;
+		}
+		
+		// hand the frame to the window if 00E0/DXYN/scrolling changed the screen
+		if(draw) publish_frame();
+		
+		// wait for the next tick
+		if(!forward)
+		{
+			Uint64 next = base_time + (ticks + 1 - base_tick)*freq/60;
+			now = SDL_GetPerformanceCounter();
+			if(next > now) SDL_Delay(((next - now)*1000 + freq - 1)/freq); // rounded up, don't spin through the last millisecond
+		}
+	}
+	return 0;
+}
+
+// window thread: handles SDL events and input, presents frames
 int main(int argc, char *argv[]) 
 {
+    // parse arguments
+	char *rom = NULL;
+	char *video = NULL, *command = NULL; // capture file and encoder
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-r") && i+1 < argc) rate = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "-a")) pattern = true;
+		else if(!strcmp(argv[i], "-l")) filter |= CHIP8_SCALE_SCANLINES;
+		else if(!strcmp(argv[i], "-c") && i+1 < argc) video = argv[++i];
+		else if(!strcmp(argv[i], "-p") && i+1 < argc) command = argv[++i];
+		else if(!strcmp(argv[i], "-f") && i+1 < argc)
+		{
+			i++;
+			for(int f = 0; f < 3; f++) if(!strcmp(argv[i], filter_names[f])) filter = (filter & CHIP8_SCALE_SCANLINES) | f;
+		}
+		else if(!strcmp(argv[i], "-m") && i+1 < argc)
+		{
+			i++;
+			for(int m = 0; m < 3; m++) if(!strcmp(argv[i], mode_names[m])) mode = m;
+		}
+		else rom = argv[i];
+	}
+	if(rate < 1) rate = 1;
+	
+	chip8.trace = chip8_trace_create(16); // last 64K instructions
+	history = chip8_rewind_create(4 << 20, 300); // 4MB, keyframe every 5 seconds
+	roms = chip8_romcache_create();
+#ifdef CHIP8_PROFILE
+	chip8.profile = chip8_profile_create();
+#endif
+	
     // load ROM if file argument exists
-	if(argc == 2) 
+	if(rom != NULL && roms != NULL) 
 	{
-		chip8_init();
-		if(!chip8_load(argv[1])) // don't run if file can't be openened
+		image = chip8_romcache_load(roms, rom, mode);
+		if(image != NULL) // don't run if file can't be openened
 		{
+			printf("Loaded %s\n", rom);
+			seed = time(NULL);
+			chip8_seed(&chip8, seed);
+			reset();
+			recording = chip8_input_create(&chip8, image, seed, quirks());
 			running = true;
+			
+			// capture at the starting window size
+			if(video || command)
+			{
+				capture = chip8_capture_create(mode, rate, video, command, scale, filter);
+				if(capture) chip8_capture_frame(capture, &chip8);
+				else printf("ERROR starting the capture\n");
+			}
 		}
+		else printf("ERROR loading %s\n", rom);
 	}
-	else printf("Usage: Jos8 [romname]");
+	else printf("Usage: Jos8 [-r instructions per second] [-m chip8|schip|xochip] [-a] [-f nearest|scale2x|scale3x] [-l] [-c video] [-p encoder command] [romname]");
 	
     // setup SDL
-    SDL_Init(SDL_INIT_VIDEO); 
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO); 
+	frame_event = SDL_RegisterEvents(1);
 	SDL_Window *window = SDL_CreateWindow("Jos8", SDL_WINDOWPOS_UNDEFINED, 
 						 SDL_WINDOWPOS_UNDEFINED, 64*scale, 32*scale,
 						 SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 	update_SDL_title(window);
 	SDL_Renderer *renderer = SDL_CreateRenderer
 							(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC); 
-	SDL_RenderSetScale(renderer, scale, scale); // scale SDL renderer
+	SDL_Texture *texture = create_picture(renderer);
+	bool redraw = true; // window needs a new frame without a screen update
 	const Uint8 *state = SDL_GetKeyboardState(NULL); // SDL scankey pointer
     SDL_Event event;
+	
+	// open the audio device: 16-bit mono with a small buffer, at most about
+	// 20ms of samples queued in front of it
+	SDL_AudioSpec want = {0};
+	want.freq = 44100;
+	want.format = AUDIO_S16SYS;
+	want.channels = 1;
+	want.samples = 128;
+	want.callback = play_audio;
+	want.userdata = audio = chip8_audio_create(want.freq, want.freq/50 + want.samples, pattern);
+	SDL_AudioDeviceID device = audio ? SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0) : 0;
+	if(device) SDL_PauseAudioDevice(device, 0);
+	else
+	{
+		printf("ERROR opening audio: %s\n", SDL_GetError());
+		if(audio) chip8_audio_destroy(audio);
+		audio = NULL;
+	}
+	
+	// start emulation, the machine belongs to its thread from here on
+	publish_frame();
+	SDL_Thread *thread = running ? SDL_CreateThread(emulate, "emulation", NULL) : NULL;
 
-	// run emulator
+	// handle the window
     while(running)
     {
 		// process SDL quit button and escape key
         while(SDL_PollEvent(&event)) 
 			{
+			// CHIP-8 keys go to the emulation thread with the time they happened
+			if((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat) queue_key(&event);
+			
 			// check for window resize
 			if(event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_RESIZED)
- 				update_SDL_size(event, renderer);
+ 				update_SDL_size(event, renderer, &texture);
+			
+			// redraw when the window was uncovered
+			else if(event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED)
+				redraw = true;
 			
 			// check user input
 			else if(event.type == SDL_KEYDOWN) 
 			{
 				if(state[SDL_SCANCODE_ESCAPE]) running = false; // quit
-		        else if(state[SDL_SCANCODE_P]) paused ^= true; // pause
-		        else if(state[SDL_SCANCODE_F5]) chip8_init(); // reset emulation
-				else if(state[SDL_SCANCODE_F6]) screen_wrap ^= true; // screen wrapping
-		        else if(state[SDL_SCANCODE_F7]) cowgod ^= true; // Cowgod syntax
-		        else if(state[SDL_SCANCODE_F8]) debug ^= true; // debug prints
+		        else if(state[SDL_SCANCODE_P]) paused = !paused; // pause
+		        else if(state[SDL_SCANCODE_F5]) commands |= COMMAND_RESET; // reset emulation
+				else if(state[SDL_SCANCODE_F6]) screen_wrap = !screen_wrap; // screen wrapping
+		        else if(state[SDL_SCANCODE_F7]) cowgod = !cowgod; // Cowgod syntax
+		        else if(state[SDL_SCANCODE_F8]) debug = !debug; // trace recording
+		        else if(state[SDL_SCANCODE_F9]) commands |= COMMAND_TRACE; // dump trace
+		        else if(state[SDL_SCANCODE_F10]) commands |= COMMAND_RECORDING; // save recording
+		        else if(state[SDL_SCANCODE_F11] && chip8.profile) overlay ^= true; // profile overlay
 		        update_SDL_title(window);
+		        redraw = true;
 			}			
 			
 			// close app
 			else if(event.type == SDL_QUIT) running = false;
 		}
-
-    	// dont emulate while paused
-        if(paused) continue; 
-        
-        // process keyboard input
-        for(int k = 0; k < 16; k++) key[k] = state[keyconvert[k]];
-        
-        // run 8 cpu cycles
-        for(int i = 0; i < 8; i++) chip8_cycle(debug, screen_wrap, cowgod);
-        
-        // update timer
-    	chip8_timerupdate();
-    	
-		// render frame at vsync
- 		render_frame(renderer, xoffset, yoffset);
+		
+		// pass the held control keys to the emulation thread
+		fast = state[SDL_SCANCODE_TAB]; // fast-forward
+		rewinding = state[SDL_SCANCODE_BACKSPACE]; // rewind
+		
+		// present the newest frame, every frame with the overlay. presenting
+		// waits for vsync, otherwise sleep until the emulation thread publishes
+		// a frame or an event comes in, at most a frame.
+		if(take_frame() || redraw || overlay)
+		{
+			upload_frame(texture, &frames[frame_front]);
+			render_frame(renderer, texture);
+			redraw = false;
+		}
+		else SDL_WaitEventTimeout(NULL, 1000/60);
+	}
+	if(thread) SDL_WaitThread(thread, NULL);
+	if(capture)
+	{
+		chip8_capturestats_t stats;
+		if(chip8_capture_destroy(capture, &stats)) printf("ERROR writing the capture\n");
+		printf("%llu frames captured: %llu written, %llu coalesced, %llu dropped\n", stats.frames, stats.written, stats.coalesced, stats.dropped);
 	}
 
 	// release SDL
+	if(device) SDL_CloseAudioDevice(device);
+	if(audio) chip8_audio_destroy(audio);
+    SDL_DestroyTexture(texture);
+	free(picture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 	SDL_Quit();
+	if(chip8.trace) chip8_trace_destroy(chip8.trace);
+	if(history) chip8_rewind_destroy(history);
+	if(roms) chip8_romcache_destroy(roms);
+	if(recording) chip8_input_destroy(recording);
+#ifdef CHIP8_PROFILE
+	if(chip8.profile)
+	{
+		chip8_profile_dump(chip8.profile, &chip8, stdout);
+		chip8_profile_destroy(chip8.profile);
+	}
+#endif
 
 	return 0;
 }
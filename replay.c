@@ -0,0 +1,232 @@
+/******************************************************************************
+replay.c
+Jos8 replayer: plays an input recording back headless at full speed.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+#include "chip8_rom.h"
+#include "chip8_input.h"
+#include "chip8_rewind.h"
+#include "chip8_scale.h"
+#include "chip8_capture.h"
+
+// seconds since an arbitrary point
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// colors of off, plane 0, plane 1 and both planes, as in the window
+const unsigned int palette[4] = CHIP8_SCALE_PALETTE;
+
+// filter names for the -f argument, in CHIP8_SCALE_ order
+const char *filter_names[3] = { "nearest", "scale2x", "scale3x" };
+
+// write a screen upscaled as a binary PPM image, returns 1 on error
+bool write_screen(const chip8_t *c, const char *name, unsigned int factor, unsigned int filter)
+{
+	unsigned int width, height;
+	chip8_scale_size(c->hires, factor, filter, &width, &height);
+	unsigned int *pixels = malloc((size_t)width*height*sizeof(unsigned int));
+	unsigned char *rgb = malloc((size_t)width*3);
+	FILE *f = fopen(name, "wb");
+	bool error = pixels == NULL || rgb == NULL || f == NULL;
+	if(!error)
+	{
+		chip8_scale(pixels, width*sizeof(unsigned int), &c->screen[0][0][0], NULL, c->hires, factor, filter, palette, NULL);
+		fprintf(f, "P6\n%u %u\n255\n", width, height);
+		for(unsigned int y = 0; y < height && !error; y++)
+		{
+			for(unsigned int x = 0; x < width; x++)
+			{
+				unsigned int p = pixels[(size_t)y*width + x];
+				rgb[3*x] = p >> 16;
+				rgb[3*x + 1] = p >> 8;
+				rgb[3*x + 2] = p;
+			}
+			error = fwrite(rgb, 3, width, f) != width;
+		}
+	}
+	if(f && fclose(f)) error = true;
+	free(pixels);
+	free(rgb);
+	return error;
+}
+
+// capture the frame of a tick (replay tick callback)
+void capture_tick(void *data, const chip8_t *c)
+{
+	chip8_capture_frame(data, c);
+}
+
+// round trip check rom: draws a pixel further right every loop while key 5 is held
+const unsigned char check_rom[] =
+{
+	0x60, 0x05, // 200: V0 = 5
+	0xE0, 0x9E, // 202: skip if key V0
+	0x12, 0x00, // 204: goto 200
+	0xA2, 0x10, // 206: I = 210
+	0xD1, 0x21, // 208: draw(V1, V2, 1)
+	0x71, 0x01, // 20A: V1 += 1
+	0x12, 0x00, // 20C: goto 200
+	0x00, 0x00,
+	0x80 // 210: pixel
+};
+
+// run a tick of the round trip session as the window does, recording it
+void check_tick(chip8_t *c, chip8_input_t *in, chip8_rewind_t *history, unsigned long long *ticks)
+{
+	chip8_run(c, (*ticks + 1)*c->rate/60 - *ticks*c->rate/60, false, true);
+	chip8_rewind_push(history, c);
+	if(++*ticks % 60 == 0) chip8_input_check(in, c);
+}
+
+// record a session that holds a key, rewinds past the press and releases it
+// later, then replay it. returns 1 if the replay doesn't end as the session did.
+bool round_trip(void)
+{
+	chip8_romcache_t *cache = chip8_romcache_create();
+	const chip8_rom_t *rom = chip8_romcache_add(cache, check_rom, sizeof(check_rom), CHIP8_MODE_CHIP8);
+	chip8_rewind_t *history = chip8_rewind_create(1 << 20, 60);
+	chip8_t *c = calloc(1, sizeof(chip8_t));
+	c->quiet = true;
+	chip8_seed(c, 1);
+	chip8_reset(c, rom);
+	chip8_setrate(c, 600);
+	chip8_input_t *in = chip8_input_create(c, rom, 1, CHIP8_INPUT_COWGOD);
+	chip8_rewind_push(history, c);
+
+	// press at tick 30, rewind to tick 10 holding it, release at tick 70
+	unsigned long long ticks = 0;
+	while(ticks < 30) check_tick(c, in, history, &ticks);
+	c->key[5] = 1;
+	chip8_input_keys(in, c);
+	while(ticks < 50) check_tick(c, in, history, &ticks);
+	for(; ticks > 10; ticks--)
+	{
+		chip8_rewind_pop(history, c);
+		chip8_input_rewind(in, c);
+	}
+	while(ticks < 70) check_tick(c, in, history, &ticks);
+	c->key[5] = 0;
+	chip8_input_keys(in, c);
+	while(ticks < 120) check_tick(c, in, history, &ticks);
+	unsigned long long hash = chip8_screenhash(c);
+
+	// replay in a fresh machine
+	chip8_t *r = calloc(1, sizeof(chip8_t));
+	r->quiet = true;
+	unsigned int checked;
+	unsigned long long first;
+	unsigned int failed = chip8_input_replay(in, r, rom, &checked, &first, NULL, NULL);
+	bool error = failed || r->cycles != c->cycles || chip8_screenhash(r) != hash;
+	printf("Round trip: %u checkpoints, %u failed, final screen %016llX, replayed %016llX: %s\n",
+		checked, failed, hash, chip8_screenhash(r), error ? "FAILED" : "ok");
+
+	free(r);
+	free(c);
+	chip8_input_destroy(in);
+	chip8_rewind_destroy(history);
+	chip8_romcache_destroy(cache);
+	return error;
+}
+
+// replayer
+int main(int argc, char *argv[])
+{
+	if(argc == 2 && !strcmp(argv[1], "-t")) return round_trip();
+
+	// options, then the recording and the rom
+	char *output = NULL; // final screen image
+	char *video = NULL, *command = NULL; // capture file and encoder
+	unsigned int factor = 10, filter = CHIP8_SCALE_NEAREST; // scale and filter of the image and the encoder
+	int i = 1;
+	for(; i < argc - 2; i++)
+	{
+		if(!strcmp(argv[i], "-o") && i+1 < argc - 2) output = argv[++i];
+		else if(!strcmp(argv[i], "-c") && i+1 < argc - 2) video = argv[++i];
+		else if(!strcmp(argv[i], "-p") && i+1 < argc - 2) command = argv[++i];
+		else if(!strcmp(argv[i], "-x") && i+1 < argc - 2) factor = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "-l")) filter |= CHIP8_SCALE_SCANLINES;
+		else if(!strcmp(argv[i], "-f") && i+1 < argc - 2)
+		{
+			i++;
+			for(int f = 0; f < 3; f++) if(!strcmp(argv[i], filter_names[f])) filter = (filter & CHIP8_SCALE_SCANLINES) | f;
+		}
+		else break;
+	}
+	if(argc - i != 2)
+	{
+		printf("Usage: Jos8-replay [-o screen.ppm] [-c video] [-p encoder command] [-x scale] [-f nearest|scale2x|scale3x] [-l] recording rom\n       Jos8-replay -t\n");
+		return 2;
+	}
+	argv += i - 1;
+
+	// read recording and the rom it was made with
+	chip8_input_t *in = chip8_input_load(argv[1]);
+	if(in == NULL)
+	{
+		fprintf(stderr, "ERROR reading %s\n", argv[1]);
+		return 2;
+	}
+	chip8_romcache_t *cache = chip8_romcache_create();
+	const chip8_rom_t *rom = cache ? chip8_romcache_load(cache, argv[2], in->header.mode) : NULL;
+	if(rom == NULL)
+	{
+		fprintf(stderr, "ERROR loading %s\n", argv[2]);
+		return 2;
+	}
+	if(rom->hash != in->header.hash || rom->len != in->header.len)
+	{
+		fprintf(stderr, "ERROR %s is not the rom %s was recorded with\n", argv[2], argv[1]);
+		return 2;
+	}
+
+	// frames of every tick that changed the screen to the capture file or encoder
+	chip8_capture_t *capture = NULL;
+	if(video || command)
+	{
+		capture = chip8_capture_create(in->header.mode, in->header.rate, video, command, factor, filter);
+		if(capture == NULL)
+		{
+			fprintf(stderr, "ERROR starting the capture\n");
+			return 2;
+		}
+	}
+
+	// replay and verify the checkpoints
+	chip8_t *c = calloc(1, sizeof(chip8_t));
+	c->quiet = true;
+	unsigned int checked;
+	unsigned long long first;
+	double start = now();
+	unsigned int failed = chip8_input_replay(in, c, rom, &checked, &first, capture ? capture_tick : NULL, capture);
+	double elapsed = now() - start;
+	if(failed) printf("First differing checkpoint at %llu instructions\n", first);
+	printf("%u events, %u checkpoints, %u failed, final screen %016llX\n", in->count, checked, failed, chip8_screenhash(c));
+	fprintf(stderr, "%llu instructions in %.3fs\n", c->cycles, elapsed);
+	if(output && write_screen(c, output, factor, filter)) fprintf(stderr, "ERROR writing %s\n", output);
+	if(capture)
+	{
+		chip8_capturestats_t stats;
+		if(chip8_capture_destroy(capture, &stats)) fprintf(stderr, "ERROR writing the capture\n");
+		fprintf(stderr, "%llu frames captured: %llu written, %llu coalesced, %llu dropped, %llu bytes\n",
+			stats.frames, stats.written, stats.coalesced, stats.dropped, stats.bytes);
+	}
+
+	// release memory
+	free(c);
+	chip8_input_destroy(in);
+	chip8_romcache_destroy(cache);
+	return failed ? 1 : 0;
+}
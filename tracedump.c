@@ -0,0 +1,200 @@
+/******************************************************************************
+tracedump.c
+Jos8 trace decoder: prints a binary trace dump as readable text.
+
+(c) 2018 Jos van Mourik
+******************************************************************************/
+
+// includes
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "chip8_trace.h"
+
+// mnemonic of an opcode on a machine variant
+const char *opcode_name(unsigned short opcode, int mode)
+{
+	// SCHIP and XO-CHIP opcodes
+	if(mode != CHIP8_MODE_CHIP8)
+	{
+		bool xo = mode == CHIP8_MODE_XOCHIP;
+		if((opcode & 0xFFF0) == 0x00C0) return "00CN scroll_down(N)";
+		if((opcode & 0xFFF0) == 0x00D0 && xo) return "00DN scroll_up(N)";
+		if(opcode == 0x00FB) return "00FB scroll_right()";
+		if(opcode == 0x00FC) return "00FC scroll_left()";
+		if(opcode == 0x00FD) return "00FD exit()";
+		if(opcode == 0x00FE) return "00FE lores()";
+		if(opcode == 0x00FF) return "00FF hires()";
+		if((opcode & 0xF00F) == 0x5002 && xo) return "5XY2 reg_dump(Vx..Vy,&I)";
+		if((opcode & 0xF00F) == 0x5003 && xo) return "5XY3 reg_load(Vx..Vy,&I)";
+		if(opcode == 0xF000 && xo) return "F000 NNNN I = NNNN";
+		if(opcode == 0xF002 && xo) return "F002 audio_pattern(&I)";
+		if((opcode & 0xF0FF) == 0xF001 && xo) return "FN01 plane(N)";
+		if((opcode & 0xF0FF) == 0xF03A && xo) return "FX3A pitch(Vx)";
+		if((opcode & 0xF0FF) == 0xF030) return "FX30 I=bigsprite_addr[Vx]";
+		if((opcode & 0xF0FF) == 0xF075) return "FX75 flags_dump(Vx)";
+		if((opcode & 0xF0FF) == 0xF085) return "FX85 flags_load(Vx)";
+	}
+	
+	switch(opcode & 0xF000)
+	{
+		case 0x0000:
+			if((opcode & 0x000F) == 0x0) return "00E0 disp_clear";
+			if((opcode & 0x000F) == 0xE) return "00EE return";
+			break;
+		case 0x1000: return "1NNN goto NNN";
+		case 0x2000: return "2NNN Call subroutine NNN";
+		case 0x3000: return "3XNN skip if(Vx==NN)";
+		case 0x4000: return "4XNN skip if(Vx!=NN)";
+		case 0x5000: return "5XY0 skip if(Vx==Vy)";
+		case 0x6000: return "6XNN Vx = NN ";
+		case 0x7000: return "7XNN Vx += NN";
+		case 0x8000:
+			switch(opcode & 0x000F)
+			{
+				case 0x0: return "8XY0 Vx=Vy";
+				case 0x1: return "8XY1 Vx|Vy";
+				case 0x2: return "8XY2 Vx=Vx&Vy";
+				case 0x3: return "8XY3 Vx=Vx^Vy";
+				case 0x4: return "8XY4 Vx += Vy";
+				case 0x5: return "8XY5 Vx -= Vy";
+				case 0x6: return "8XY6 Vx=Vy=Vy>>1";
+				case 0x7: return "8XY7 Vx=Vy-Vx";
+				case 0xE: return "8XYE Vx=Vy=Vy<<1";
+			}
+			break;
+		case 0x9000: return "9XY0 skip if(Vx!=Vy)";
+		case 0xA000: return "ANNN I = NNN";
+		case 0xB000: return "BNNN PC=V0+NNN";
+		case 0xC000: return "CXNN Vx=rand()&NN";
+		case 0xD000: return "DXYN draw(Vx,Vy,N)";
+		case 0xE000:
+			if((opcode & 0x000F) == 0xE) return "EX9E if(key()==Vx)";
+			if((opcode & 0x000F) == 0x1) return "EXA1 if(key()!=Vx)";
+			break;
+		case 0xF000:
+			switch(opcode & 0x00FF)
+			{
+				case 0x07: return "FX07 Vx = get_delay()";
+				case 0x0A: return "FX0A";
+				case 0x15: return "FX15 delay_timer(Vx)";
+				case 0x18: return "FX18 sound_timer(Vx)";
+				case 0x1E: return "FX1E I +=Vx";
+				case 0x29: return "FX29 I=sprite_addr[Vx] ";
+				case 0x33: return "FX33 set_BCD(Vx);";
+				case 0x55: return "FX55 reg_dump(Vx,&I)";
+				case 0x65: return "FX65 reg_load(Vx,&I)";
+			}
+			break;
+	}
+	return "unknown opcode";
+}
+
+// trace decoder
+// records only carry the registers an instruction wrote, so the full register
+// and stack state is rebuilt: forward from the values in the records, and
+// backward from the machine state stored at the time of the dump.
+int main(int argc, char *argv[])
+{
+	const char *file = argc > 1 ? argv[1] : CHIP8_TRACE_FILE;
+	FILE *fp = fopen(file, "rb");
+	if(fp == NULL)
+	{
+		printf("Usage: Jos8-trace [trace file]\nERROR opening %s\n", file);
+		return 1;
+	}
+
+	// read header and records
+	chip8_tracefile_t h;
+	if(fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, "J8TR", 4))
+	{
+		printf("ERROR %s is not a trace file\n", file);
+		fclose(fp);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, sizeof(h), SEEK_SET);
+	if(size < (long)sizeof(h)) size = sizeof(h);
+	size_t count = (size - sizeof(h))/sizeof(chip8_record_t);
+	if(h.count < count) count = h.count;
+	chip8_record_t *r = malloc(sizeof(chip8_record_t)*(count + 1));
+	if(r == NULL)
+	{
+		printf("ERROR out of memory reading %s\n", file);
+		fclose(fp);
+		return 1;
+	}
+	h.count = fread(r, sizeof(chip8_record_t), count, fp);
+	fclose(fp);
+
+	// the machine state only follows the records if nothing ran in between,
+	// and only the records after the last gap in the instruction count lead up to it
+	long from = h.count;
+	if(h.count && h.cycle == h.last + 1)
+	{
+		for(from = h.count - 1; from > 0 && r[from].cycle == r[from - 1].cycle + 1; from--);
+	}
+	else if(h.count) printf("WARNING machine state was saved at #%u, not after the last record, registers are not filled in backward\n", h.cycle);
+
+	// last record that writes each register and stack entry
+	long lastV[16], lastS[16];
+	for(int i = 0; i < 16; i++) lastV[i] = lastS[i] = -1;
+	for(long k = 0; k < h.count; k++)
+	{
+		for(int i = 0; i < 16; i++) if(r[k].changed >> i & 1) lastV[i] = k;
+		if((r[k].opcode & 0xF000) == 0x2000) lastS[r[k].sp & 0xF] = k;
+	}
+
+	// print state before each instruction, then apply what it wrote
+	int V[16], S[16]; // -1 = unknown
+	for(int i = 0; i < 16; i++) V[i] = S[i] = -1;
+	for(long k = 0; k < h.count; k++)
+	{
+		for(int i = 0; i < 16; i++)
+		{
+			if(k > lastV[i] && k >= from) V[i] = h.V[i];
+			if(k > lastS[i] && k >= from) S[i] = h.stack[i];
+		}
+
+		printf("\n#%u\nSP=%X  Stack=[", r[k].cycle, r[k].sp);
+		for(int i = 0; i < 16; i++)
+		{
+			if(S[i] < 0) printf("???");
+			else printf("%03X", S[i]);
+			printf(i < 15 ? " " : "]\n");
+		}
+		printf("PC=0x%X  I=0x%03X  V=[", r[k].pc, r[k].I);
+		for(int i = 0; i < 16; i++)
+		{
+			if(V[i] < 0) printf("??");
+			else printf("%02X", V[i]);
+			printf(i < 15 ? " " : "]\n");
+		}
+		printf("Opcode=0x%04X: %s\n", r[k].opcode, opcode_name(r[k].opcode, r[k].quirks >> 2));
+
+		int x = (r[k].opcode & 0x0F00) >> 8;
+		int y = (r[k].opcode & 0x00F0) >> 4;
+		bool shift = (r[k].opcode & 0xF007) == 0x8006 && !(r[k].quirks & 1); // 8XY6/8XYE store in Vy too
+		for(int i = 0; i < 16; i++)
+		{
+			if(!(r[k].changed >> i & 1)) continue;
+			if(i == 0xF) V[i] = r[k].flag;
+			else if(i == x || (shift && i == y)) V[i] = r[k].value;
+			else V[i] = -1;
+		}
+		if((r[k].opcode & 0xF000) == 0x2000) S[r[k].sp & 0xF] = (r[k].pc + 2) & 0xFFFF;
+	}
+
+	// final state
+	printf("\nSP=%X  Stack=[", h.sp);
+	for(int i = 0; i < 16; i++) printf(i < 15 ? "%03X " : "%03X]\n", h.stack[i]);
+	printf("PC=0x%X  I=0x%03X  V=[", h.pc, h.I);
+	for(int i = 0; i < 16; i++) printf(i < 15 ? "%02X " : "%02X]\n", h.V[i]);
+
+	free(r);
+	return 0;
+}